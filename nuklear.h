@@ -135,12 +135,16 @@ Define                          | Description
 NK_BUFFER_DEFAULT_INITIAL_SIZE  | Initial buffer size allocated by all buffers while using the default allocator functions included by defining NK_INCLUDE_DEFAULT_ALLOCATOR. If you don't want to allocate the default 4k memory then redefine it.
 NK_MAX_NUMBER_BUFFER            | Maximum buffer size for the conversion buffer between float and string Under normal circumstances this should be more than sufficient.
 NK_INPUT_MAX                    | Defines the max number of bytes which can be added as text input in one frame. Under normal circumstances this should be more than sufficient.
+NK_FONT_LATIN_GLYPHS            | Codepoints below this are mapped to their glyph through a direct lookup table in each baked font. Defaults to 256, which covers Latin-1.
+NK_FONT_MAX_RANGES              | Maximum number of glyph ranges above NK_FONT_LATIN_GLYPHS that a font looks up by binary search. Fonts with more, or with overlapping ranges, fall back to scanning every range.
 
 !!! WARNING
     The following constants if defined need to be defined for both header and implementation:
     - NK_MAX_NUMBER_BUFFER
     - NK_BUFFER_DEFAULT_INITIAL_SIZE
     - NK_INPUT_MAX
+    - NK_FONT_LATIN_GLYPHS
+    - NK_FONT_MAX_RANGES
 
 ### Dependencies
 Function    | Description
@@ -4279,6 +4283,18 @@ struct nk_font_glyph {
     float u0, v0, u1, v1;
 };
 
+#ifndef NK_FONT_LATIN_GLYPHS
+#define NK_FONT_LATIN_GLYPHS 256 /**!< codepoints below this are looked up directly */
+#endif
+#ifndef NK_FONT_MAX_RANGES
+#define NK_FONT_MAX_RANGES 32    /**!< ranges above NK_FONT_LATIN_GLYPHS searched by bisection */
+#endif
+
+struct nk_font_glyph_range {
+    nk_rune first, last;
+    int glyph; /**!< index of the first codepoint's glyph in nk_font.glyphs */
+};
+
 struct nk_font {
     struct nk_font *next;
     struct nk_user_font handle;
@@ -4289,6 +4305,11 @@ struct nk_font {
     nk_rune fallback_codepoint;
     nk_handle texture;
     struct nk_font_config *config;
+
+    /* glyph lookup tables filled in by nk_font_init() */
+    const struct nk_font_glyph *latin[NK_FONT_LATIN_GLYPHS]; /**!< 0 if not in the font */
+    struct nk_font_glyph_range ranges[NK_FONT_MAX_RANGES];   /**!< sorted by first codepoint */
+    int range_count; /**!< -1 if the ranges overlap or don't fit: scan the configs instead */
 };
 
 enum nk_font_atlas_format {
@@ -17310,6 +17331,53 @@ nk_font_query_font_glyph(nk_handle handle, float height,
     glyph->uv[1] = nk_vec2(g->u1, g->v1);
 }
 #endif
+NK_INTERN void
+nk_font_build_lookup(struct nk_font *font)
+{
+    int i = 0, j;
+    int count;
+    int total_glyphs = 0;
+    const struct nk_font_config *iter = font->config;
+
+    nk_zero(font->latin, sizeof(font->latin));
+    font->range_count = 0;
+    do {count = nk_range_count(iter->range);
+        for (i = 0; i < count; ++i) {
+            nk_rune f = iter->range[(i*2)+0];
+            nk_rune t = iter->range[(i*2)+1];
+            nk_rune c;
+            /* earlier ranges win, as in the scan of nk_font_find_glyph */
+            for (c = f; c <= t && c < NK_FONT_LATIN_GLYPHS; ++c) {
+                if (!font->latin[c])
+                    font->latin[c] = &font->glyphs[(nk_rune)total_glyphs + (c - f)];
+            }
+            if (t >= NK_FONT_LATIN_GLYPHS && font->range_count >= 0) {
+                if (font->range_count == NK_FONT_MAX_RANGES) {
+                    font->range_count = -1;
+                } else {
+                    /* insert in order of first codepoint */
+                    struct nk_font_glyph_range range;
+                    range.first = NK_MAX(f, (nk_rune)NK_FONT_LATIN_GLYPHS);
+                    range.last = t;
+                    range.glyph = total_glyphs + (int)(range.first - f);
+                    for (j = font->range_count; j > 0 && font->ranges[j-1].first > range.first; --j)
+                        font->ranges[j] = font->ranges[j-1];
+                    font->ranges[j] = range;
+                    font->range_count++;
+                }
+            }
+            total_glyphs += (int)((t - f) + 1);
+        }
+    } while ((iter = iter->n) != font->config);
+
+    /* with overlaps the first range listed wins, which bisection can't tell */
+    for (j = 1; j < font->range_count; ++j) {
+        if (font->ranges[j].first <= font->ranges[j-1].last) {
+            font->range_count = -1;
+            break;
+        }
+    }
+}
 NK_API const struct nk_font_glyph*
 nk_font_find_glyph(const struct nk_font *font, nk_rune unicode)
 {
@@ -17325,6 +17393,22 @@ nk_font_find_glyph(const struct nk_font *font, nk_rune unicode)
     if (!font || !font->glyphs) return 0;
 
     glyph = font->fallback;
+    if (unicode < NK_FONT_LATIN_GLYPHS) {
+        const struct nk_font_glyph *latin = font->latin[unicode];
+        return latin ? latin : glyph;
+    }
+    if (font->range_count >= 0) {
+        int lo = 0, hi = font->range_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            const struct nk_font_glyph_range *range = &font->ranges[mid];
+            if (unicode < range->first) hi = mid;
+            else if (unicode > range->last) lo = mid + 1;
+            else return &font->glyphs[(nk_rune)range->glyph + (unicode - range->first)];
+        }
+        return glyph;
+    }
+
     iter = font->config;
     do {count = nk_range_count(iter->range);
         for (i = 0; i < count; ++i) {
@@ -17357,6 +17441,7 @@ nk_font_init(struct nk_font *font, float pixel_height,
     font->glyphs = &glyphs[baked_font->glyph_offset];
     font->texture = atlas;
     font->fallback_codepoint = fallback_codepoint;
+    nk_font_build_lookup(font);
     font->fallback = nk_font_find_glyph(font, fallback_codepoint);
 
     font->handle.height = font->info.height * font->scale;
@@ -18,10 +18,12 @@
 NK_API struct nk_context*   nk_sdl_init(SDL_Window *win, SDL_Renderer *renderer);
 NK_API void                 nk_sdl_font_stash_begin(struct nk_font_atlas **atlas);
 NK_API void                 nk_sdl_font_stash_end(void);
+NK_API void                 nk_sdl_font_cache(const char *path);
 NK_API int                  nk_sdl_handle_event(SDL_Event *evt);
 NK_API void                 nk_sdl_render(enum nk_anti_aliasing);
 NK_API void                 nk_sdl_shutdown(void);
 NK_API void                 nk_sdl_handle_grab(void);
+NK_API nk_size              nk_sdl_allocations(void);
 
 #if SDL_COMPILEDVERSION < SDL_VERSIONNUM(2, 0, 22)
 /* Metal API does not support cliprects with negative coordinates or large
@@ -33,6 +35,21 @@ NK_API void                 nk_sdl_handle_grab(void);
 #define NK_SDL_CLAMP_CLIP_RECT
 #endif
 
+/* The context and the converted geometry live in one block allocated by
+ * nk_sdl_init() and never grow; raise these if the log reports overflows */
+#ifndef NK_SDL_CONTEXT_MEMORY
+#define NK_SDL_CONTEXT_MEMORY (256 * 1024) /* commands, windows and panels */
+#endif
+#ifndef NK_SDL_COMMAND_MEMORY
+#define NK_SDL_COMMAND_MEMORY (32 * 1024)  /* converted draw commands */
+#endif
+#ifndef NK_SDL_VERTEX_MEMORY
+#define NK_SDL_VERTEX_MEMORY (512 * 1024)
+#endif
+#ifndef NK_SDL_ELEMENT_MEMORY
+#define NK_SDL_ELEMENT_MEMORY (128 * 1024)
+#endif
+
 #endif /* NK_SDL_RENDERER_H_ */
 
 /*
@@ -48,6 +65,13 @@ NK_API void                 nk_sdl_handle_grab(void);
 
 struct nk_sdl_device {
     struct nk_buffer cmds;
+    struct nk_buffer vbuf, ebuf; /* fixed, in the arena; kept across frames */
+    nk_hash cmds_hash;           /* hash of the commands vbuf and ebuf were built from */
+    int converted;               /* vbuf, ebuf and cmds hold a complete conversion */
+    SDL_Texture *overlay;        /* the UI as last drawn, composited every frame */
+    int overlay_w, overlay_h;
+    int overlay_dirty;           /* overlay must be redrawn even if the UI is unchanged */
+    int overlay_failed;          /* no render targets; draw straight to the screen */
     struct nk_draw_null_texture tex_null;
     SDL_Texture *font_tex;
 };
@@ -64,9 +88,54 @@ static struct nk_sdl {
     struct nk_sdl_device ogl;
     struct nk_context ctx;
     struct nk_font_atlas atlas;
+    struct nk_allocator alloc;
+    nk_size allocations;
+    void *arena;           /* backs the context and the device's buffers */
+    nk_size ctx_needed;    /* ctx.memory.needed and .size when the frame began */
+    nk_size ctx_back;
+    nk_flags overflows;    /* NK_CONVERT_* flags, plus NK_SDL_CONTEXT_FULL */
+    const char *font_cache;
     Uint64 time_of_last_frame;
 } sdl;
 
+#define NK_SDL_CONTEXT_FULL (1 << 8)
+
+/* Log each kind of overflow once; the UI then loses what didn't fit */
+NK_INTERN void
+nk_sdl_overflow(nk_flags what)
+{
+    if (sdl.overflows & what) return;
+    sdl.overflows |= what;
+    SDL_Log("UI memory full, raise %s",
+        what == NK_SDL_CONTEXT_FULL ? "NK_SDL_CONTEXT_MEMORY" :
+        what == NK_CONVERT_COMMAND_BUFFER_FULL ? "NK_SDL_COMMAND_MEMORY" :
+        what == NK_CONVERT_VERTEX_BUFFER_FULL ? "NK_SDL_VERTEX_MEMORY" : "NK_SDL_ELEMENT_MEMORY");
+}
+
+/* nk_malloc() that counts, so callers can check the UI path stops allocating */
+NK_INTERN void*
+nk_sdl_alloc(nk_handle unused, void *old, nk_size size)
+{
+    NK_UNUSED(unused);
+    NK_UNUSED(old);
+    sdl.allocations++;
+    return malloc(size);
+}
+
+NK_INTERN void
+nk_sdl_free(nk_handle unused, void *ptr)
+{
+    NK_UNUSED(unused);
+    free(ptr);
+}
+
+/* Heap allocations made by the backend: the arena and the font atlas */
+NK_API nk_size
+nk_sdl_allocations(void)
+{
+    return sdl.allocations;
+}
+
 NK_INTERN void
 nk_sdl_device_upload_atlas(const void *image, int width, int height)
 {
@@ -82,27 +151,147 @@ nk_sdl_device_upload_atlas(const void *image, int width, int height)
     dev->font_tex = g_SDLFontTexture;
 }
 
-NK_API void
-nk_sdl_render(enum nk_anti_aliasing AA)
+/* One geometry call for a run of elements; clip is the renderer's current
+ * clip rect (if clipped), and is only set again when the run needs another */
+NK_INTERN void
+nk_sdl_draw_run(SDL_Texture *texture, const SDL_Rect *run_clip,
+    const nk_draw_index *first, unsigned int count, SDL_Rect *clip, SDL_bool *clipped)
+{
+    struct nk_sdl_device *dev = &sdl.ogl;
+    const void *vertices = nk_buffer_memory_const(&dev->vbuf);
+    int vs = sizeof(struct nk_sdl_vertex);
+    size_t vp = offsetof(struct nk_sdl_vertex, position);
+    size_t vt = offsetof(struct nk_sdl_vertex, uv);
+    size_t vc = offsetof(struct nk_sdl_vertex, col);
+
+    if (!*clipped || !SDL_RectEquals(clip, run_clip)) {
+        SDL_RenderSetClipRect(sdl.renderer, run_clip);
+        *clip = *run_clip;
+        *clipped = SDL_TRUE;
+    }
+    SDL_RenderGeometryRaw(sdl.renderer, texture,
+            (const float*)((const nk_byte*)vertices + vp), vs,
+            (const SDL_Color*)((const nk_byte*)vertices + vc), vs,
+            (const float*)((const nk_byte*)vertices + vt), vs,
+            (dev->vbuf.needed / vs),
+            (void *) first, (int)count, 2);
+}
+
+/* Submit the converted draw commands to the current render target.
+ * Commands that share a clip rect and texture are contiguous in the
+ * element buffer, so each run of them goes out as one geometry call. */
+NK_INTERN void
+nk_sdl_draw_commands(void)
 {
-    /* setup global state */
     struct nk_sdl_device *dev = &sdl.ogl;
+    SDL_Rect saved_clip, clip, run_clip;
+#ifdef NK_SDL_CLAMP_CLIP_RECT
+    SDL_Rect viewport;
+#endif
+    SDL_bool clipping_enabled, clipped;
+    const struct nk_draw_command *cmd;
+    const nk_draw_index *offset = NULL;
+    const nk_draw_index *run = NULL;
+    unsigned int run_count = 0;
+    SDL_Texture *run_texture = NULL;
+
+    /* iterate over and execute each draw command */
+    offset = (const nk_draw_index*)nk_buffer_memory_const(&dev->ebuf);
+
+    clipping_enabled = SDL_RenderIsClipEnabled(sdl.renderer);
+    SDL_RenderGetClipRect(sdl.renderer, &saved_clip);
+#ifdef NK_SDL_CLAMP_CLIP_RECT
+    SDL_RenderGetViewport(sdl.renderer, &viewport);
+#endif
+    clip = saved_clip;
+    clipped = clipping_enabled;
 
+    nk_draw_foreach(cmd, &sdl.ctx, &dev->cmds)
     {
-        SDL_Rect saved_clip;
+        SDL_Rect r;
+        if (!cmd->elem_count) continue;
+
+        r.x = cmd->clip_rect.x;
+        r.y = cmd->clip_rect.y;
+        r.w = cmd->clip_rect.w;
+        r.h = cmd->clip_rect.h;
 #ifdef NK_SDL_CLAMP_CLIP_RECT
-        SDL_Rect viewport;
+        if (r.x < 0) {
+            r.w += r.x;
+            r.x = 0;
+        }
+        if (r.y < 0) {
+            r.h += r.y;
+            r.y = 0;
+        }
+        if (r.h > viewport.h) {
+            r.h = viewport.h;
+        }
+        if (r.w > viewport.w) {
+            r.w = viewport.w;
+        }
 #endif
-        SDL_bool clipping_enabled;
-        int vs = sizeof(struct nk_sdl_vertex);
-        size_t vp = offsetof(struct nk_sdl_vertex, position);
-        size_t vt = offsetof(struct nk_sdl_vertex, uv);
-        size_t vc = offsetof(struct nk_sdl_vertex, col);
 
-        /* convert from command queue into draw list and draw to screen */
-        const struct nk_draw_command *cmd;
-        const nk_draw_index *offset = NULL;
-        struct nk_buffer vbuf, ebuf;
+        /* extend the current run, or draw it and start the next */
+        if (!run_count || (SDL_Texture *)cmd->texture.ptr != run_texture ||
+            !SDL_RectEquals(&r, &run_clip)) {
+            if (run_count)
+                nk_sdl_draw_run(run_texture, &run_clip, run, run_count, &clip, &clipped);
+            run = offset;
+            run_count = 0;
+            run_texture = (SDL_Texture *)cmd->texture.ptr;
+            run_clip = r;
+        }
+        run_count += cmd->elem_count;
+        offset += cmd->elem_count;
+    }
+    if (run_count)
+        nk_sdl_draw_run(run_texture, &run_clip, run, run_count, &clip, &clipped);
+
+    /* put the caller's clip back, if it was changed at all */
+    if (clipped != clipping_enabled || (clipped && !SDL_RectEquals(&clip, &saved_clip)))
+        SDL_RenderSetClipRect(sdl.renderer, clipping_enabled ? &saved_clip : NULL);
+}
+
+/* Make sure the overlay texture matches the window; 0 if there can't be one */
+NK_INTERN int
+nk_sdl_prepare_overlay(void)
+{
+    struct nk_sdl_device *dev = &sdl.ogl;
+    int w, h;
+
+    if (dev->overlay_failed) return 0;
+    SDL_GetWindowSize(sdl.win, &w, &h);
+    if (dev->overlay && dev->overlay_w == w && dev->overlay_h == h) return 1;
+
+    if (dev->overlay) SDL_DestroyTexture(dev->overlay);
+    dev->overlay = NULL;
+    if (SDL_RenderTargetSupported(sdl.renderer))
+        dev->overlay = SDL_CreateTexture(sdl.renderer, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, w, h);
+    /* the overlay holds premultiplied colour, so it needs a custom blend */
+    if (!dev->overlay || SDL_SetTextureBlendMode(dev->overlay, SDL_ComposeCustomBlendMode(
+            SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+            SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD)) < 0) {
+        if (dev->overlay) SDL_DestroyTexture(dev->overlay);
+        dev->overlay = NULL;
+        dev->overlay_failed = 1;
+        return 0;
+    }
+    dev->overlay_w = w;
+    dev->overlay_h = h;
+    dev->overlay_dirty = 1;
+    return 1;
+}
+
+NK_API void
+nk_sdl_render(enum nk_anti_aliasing AA)
+{
+    /* setup global state */
+    struct nk_sdl_device *dev = &sdl.ogl;
+
+    {
+        int changed;
 
         /* fill converting configuration */
         struct nk_convert_config config;
@@ -129,73 +318,64 @@ nk_sdl_render(enum nk_anti_aliasing AA)
         config.shape_AA = AA;
         config.line_AA = AA;
 
-        /* convert shapes into vertexes */
-        nk_buffer_init_default(&vbuf);
-        nk_buffer_init_default(&ebuf);
-        nk_convert(&sdl.ctx, &dev->cmds, &vbuf, &ebuf, &config);
-
-        /* iterate over and execute each draw command */
-        offset = (const nk_draw_index*)nk_buffer_memory_const(&ebuf);
+        /* every request adds to needed, but only the ones that fit use up
+         * the front or move the back, so a difference means some didn't */
+        if (sdl.ctx.memory.needed - sdl.ctx_needed >
+            sdl.ctx.memory.allocated + (sdl.ctx_back - sdl.ctx.memory.size))
+            nk_sdl_overflow(NK_SDL_CONTEXT_FULL);
 
-        clipping_enabled = SDL_RenderIsClipEnabled(sdl.renderer);
-        SDL_RenderGetClipRect(sdl.renderer, &saved_clip);
-#ifdef NK_SDL_CLAMP_CLIP_RECT
-        SDL_RenderGetViewport(sdl.renderer, &viewport);
-#endif
-
-        nk_draw_foreach(cmd, &sdl.ctx, &dev->cmds)
+        /* convert shapes into vertexes, unless the commands are the same as
+         * last frame's; nk__begin() links the windows' commands first, so
+         * the hash covers their order as well as their contents */
+        nk__begin(&sdl.ctx);
         {
-            if (!cmd->elem_count) continue;
-
-            {
-                SDL_Rect r;
-                r.x = cmd->clip_rect.x;
-                r.y = cmd->clip_rect.y;
-                r.w = cmd->clip_rect.w;
-                r.h = cmd->clip_rect.h;
-#ifdef NK_SDL_CLAMP_CLIP_RECT
-                if (r.x < 0) {
-                    r.w += r.x;
-                    r.x = 0;
-                }
-                if (r.y < 0) {
-                    r.h += r.y;
-                    r.y = 0;
-                }
-                if (r.h > viewport.h) {
-                    r.h = viewport.h;
-                }
-                if (r.w > viewport.w) {
-                    r.w = viewport.w;
-                }
-#endif
-                SDL_RenderSetClipRect(sdl.renderer, &r);
-            }
-
-            {
-                const void *vertices = nk_buffer_memory_const(&vbuf);
-
-                SDL_RenderGeometryRaw(sdl.renderer,
-                        (SDL_Texture *)cmd->texture.ptr,
-                        (const float*)((const nk_byte*)vertices + vp), vs,
-                        (const SDL_Color*)((const nk_byte*)vertices + vc), vs,
-                        (const float*)((const nk_byte*)vertices + vt), vs,
-                        (vbuf.needed / vs),
-                        (void *) offset, cmd->elem_count, 2);
-
-                offset += cmd->elem_count;
+            nk_hash hash = nk_murmur_hash(nk_buffer_memory_const(&sdl.ctx.memory),
+                                          (int)sdl.ctx.memory.allocated, (nk_hash)AA);
+            changed = !dev->converted || hash != dev->cmds_hash;
+            if (changed) {
+                nk_buffer_clear(&dev->cmds);
+                nk_buffer_clear(&dev->vbuf);
+                nk_buffer_clear(&dev->ebuf);
+                nk_flags result = nk_convert(&sdl.ctx, &dev->cmds, &dev->vbuf, &dev->ebuf,
+                                             &config);
+                if (result & NK_CONVERT_COMMAND_BUFFER_FULL)
+                    nk_sdl_overflow(NK_CONVERT_COMMAND_BUFFER_FULL);
+                if (result & NK_CONVERT_VERTEX_BUFFER_FULL)
+                    nk_sdl_overflow(NK_CONVERT_VERTEX_BUFFER_FULL);
+                if (result & NK_CONVERT_ELEMENT_BUFFER_FULL)
+                    nk_sdl_overflow(NK_CONVERT_ELEMENT_BUFFER_FULL);
+                dev->converted = result == NK_CONVERT_SUCCESS;
+                dev->cmds_hash = hash;
             }
         }
 
-        SDL_RenderSetClipRect(sdl.renderer, &saved_clip);
-        if (!clipping_enabled) {
-            SDL_RenderSetClipRect(sdl.renderer, NULL);
+        /* draw the overlay into its texture only when it has changed, and
+         * otherwise just put last frame's texture back on top */
+        if (nk_sdl_prepare_overlay()) {
+            if (changed || dev->overlay_dirty) {
+                SDL_Texture *target = SDL_GetRenderTarget(sdl.renderer);
+                SDL_BlendMode blend;
+                Uint8 r, g, b, a;
+                SDL_GetRenderDrawBlendMode(sdl.renderer, &blend);
+                SDL_GetRenderDrawColor(sdl.renderer, &r, &g, &b, &a);
+                SDL_SetRenderTarget(sdl.renderer, dev->overlay);
+                SDL_SetRenderDrawBlendMode(sdl.renderer, SDL_BLENDMODE_NONE);
+                SDL_SetRenderDrawColor(sdl.renderer, 0, 0, 0, 0);
+                SDL_RenderClear(sdl.renderer);
+                nk_sdl_draw_commands();
+                SDL_SetRenderTarget(sdl.renderer, target);
+                SDL_SetRenderDrawBlendMode(sdl.renderer, blend);
+                SDL_SetRenderDrawColor(sdl.renderer, r, g, b, a);
+                dev->overlay_dirty = !dev->converted;
+            }
+            SDL_RenderCopy(sdl.renderer, dev->overlay, NULL, NULL);
+        } else {
+            nk_sdl_draw_commands();
         }
 
         nk_clear(&sdl.ctx);
-        nk_buffer_clear(&dev->cmds);
-        nk_buffer_free(&vbuf);
-        nk_buffer_free(&ebuf);
+        sdl.ctx_needed = sdl.ctx.memory.needed;
+        sdl.ctx_back = sdl.ctx.memory.size;
     }
 }
 
@@ -246,18 +426,201 @@ nk_sdl_init(SDL_Window *win, SDL_Renderer *renderer)
     sdl.win = win;
     sdl.renderer = renderer;
     sdl.time_of_last_frame = SDL_GetTicks64();
-    nk_init_default(&sdl.ctx, 0);
+    sdl.alloc.userdata.ptr = 0;
+    sdl.alloc.alloc = nk_sdl_alloc;
+    sdl.alloc.free = nk_sdl_free;
+
+    /* one block for everything the frame loop needs, so it never allocates;
+     * the convert buffers are bump allocators reset for each conversion */
+    sdl.arena = sdl.alloc.alloc(sdl.alloc.userdata, 0, NK_SDL_CONTEXT_MEMORY +
+        NK_SDL_COMMAND_MEMORY + NK_SDL_VERTEX_MEMORY + NK_SDL_ELEMENT_MEMORY);
+    if (!sdl.arena) return 0;
+    {
+        nk_byte *block = (nk_byte*)sdl.arena;
+        nk_init_fixed(&sdl.ctx, block, NK_SDL_CONTEXT_MEMORY, 0);
+        block += NK_SDL_CONTEXT_MEMORY;
+        nk_buffer_init_fixed(&sdl.ogl.cmds, block, NK_SDL_COMMAND_MEMORY);
+        block += NK_SDL_COMMAND_MEMORY;
+        nk_buffer_init_fixed(&sdl.ogl.vbuf, block, NK_SDL_VERTEX_MEMORY);
+        block += NK_SDL_VERTEX_MEMORY;
+        nk_buffer_init_fixed(&sdl.ogl.ebuf, block, NK_SDL_ELEMENT_MEMORY);
+    }
+    sdl.ctx_needed = sdl.ctx.memory.needed;
+    sdl.ctx_back = sdl.ctx.memory.size;
     sdl.ctx.clip.copy = nk_sdl_clipboard_copy;
     sdl.ctx.clip.paste = nk_sdl_clipboard_paste;
     sdl.ctx.clip.userdata = nk_handle_ptr(0);
-    nk_buffer_init_default(&sdl.ogl.cmds);
     return &sdl.ctx;
 }
 
+/* Baked atlas cache (nk_sdl_font_cache).  Baking rasterizes and packs
+ * every glyph; the file keeps what that produced, keyed by a hash of
+ * the font configs, so later runs only read it back.  It is a private
+ * cache in the machine's own layout, and anything that doesn't match
+ * the current fonts and build is simply baked again and overwritten. */
+#define NK_SDL_ATLAS_MAGIC "NKA1"
+
+struct nk_sdl_atlas_header {
+    char magic[4];
+    nk_hash key;
+    int width, height;
+    int glyph_count;
+    int font_count;
+    struct nk_recti custom;
+};
+
+NK_INTERN nk_hash
+nk_sdl_atlas_key(const struct nk_font_atlas *atlas)
+{
+    const int layout[] = {
+        (int)sizeof(struct nk_font_glyph), (int)sizeof(struct nk_baked_font),
+        (int)sizeof(struct nk_cursor), NK_CURSOR_COUNT
+    };
+    const struct nk_font_config *it;
+    nk_hash key = nk_murmur_hash(layout, (int)sizeof(layout), 0);
+
+    for (it = atlas->config; it; it = it->next) {
+        const struct nk_font_config *cfg = it;
+        do {
+            const float sizes[] = { cfg->size, cfg->spacing.x, cfg->spacing.y };
+            const int flags[] = {
+                cfg->merge_mode, cfg->pixel_snap, cfg->oversample_v, cfg->oversample_h,
+                (int)cfg->coord_type, (int)cfg->fallback_glyph
+            };
+            int ranges = 0;
+            while (cfg->range[ranges]) ranges++;
+            key = nk_murmur_hash(cfg->ttf_blob, (int)cfg->ttf_size, key);
+            key = nk_murmur_hash(sizes, (int)sizeof(sizes), key);
+            key = nk_murmur_hash(flags, (int)sizeof(flags), key);
+            key = nk_murmur_hash(cfg->range, ranges * (int)sizeof(nk_rune), key);
+            cfg = cfg->n;
+        } while (cfg != it);
+    }
+    return key;
+}
+
+/* Fill the atlas from the cache instead of baking it; 0 on a miss */
+NK_INTERN const void*
+nk_sdl_load_atlas(nk_hash key, int *width, int *height)
+{
+    struct nk_font_atlas *atlas = &sdl.atlas;
+    struct nk_sdl_atlas_header header;
+    struct nk_font *font;
+    struct nk_font_glyph *glyphs = 0;
+    void *pixel = 0;
+    nk_byte *alpha = 0;
+    SDL_RWops *file;
+    int fonts = 0, ok = 0;
+
+    if (!sdl.font_cache) return 0;
+    file = SDL_RWFromFile(sdl.font_cache, "rb");
+    if (!file) return 0;
+
+    for (font = atlas->fonts; font; font = font->next) fonts++;
+    if (SDL_RWread(file, &header, sizeof(header), 1) != 1 ||
+        memcmp(header.magic, NK_SDL_ATLAS_MAGIC, 4) != 0 || header.key != key ||
+        header.font_count != fonts || header.glyph_count <= 0 ||
+        header.width <= 0 || header.height <= 0)
+        goto done;
+
+    glyphs = (struct nk_font_glyph*)atlas->permanent.alloc(atlas->permanent.userdata, 0,
+        sizeof(struct nk_font_glyph) * (nk_size)header.glyph_count);
+    pixel = atlas->temporary.alloc(atlas->temporary.userdata, 0,
+        (nk_size)header.width * (nk_size)header.height * 4);
+    alpha = (nk_byte*)atlas->temporary.alloc(atlas->temporary.userdata, 0,
+        (nk_size)header.width * (nk_size)header.height);
+    if (!glyphs || !pixel || !alpha) goto done;
+
+    for (font = atlas->fonts; font; font = font->next) {
+        if (SDL_RWread(file, font->config->font, sizeof(struct nk_baked_font), 1) != 1)
+            goto done;
+        font->config->font->ranges = font->config->range;
+    }
+    if (SDL_RWread(file, atlas->cursors, sizeof(atlas->cursors), 1) != 1 ||
+        SDL_RWread(file, glyphs, sizeof(struct nk_font_glyph), (size_t)header.glyph_count)
+            != (size_t)header.glyph_count ||
+        SDL_RWread(file, alpha, (size_t)header.width, (size_t)header.height)
+            != (size_t)header.height)
+        goto done;
+    nk_font_bake_convert(pixel, header.width, header.height, alpha);
+    ok = 1;
+
+done:
+    SDL_RWclose(file);
+    if (alpha) atlas->temporary.free(atlas->temporary.userdata, alpha);
+    if (!ok) {
+        if (glyphs) atlas->permanent.free(atlas->permanent.userdata, glyphs);
+        if (pixel) atlas->temporary.free(atlas->temporary.userdata, pixel);
+        return 0;
+    }
+
+    /* what nk_font_atlas_bake() leaves behind */
+    atlas->glyphs = glyphs;
+    atlas->glyph_count = header.glyph_count;
+    atlas->custom = header.custom;
+    atlas->pixel = pixel;
+    atlas->tex_width = *width = header.width;
+    atlas->tex_height = *height = header.height;
+    for (font = atlas->fonts; font; font = font->next) {
+        struct nk_font_config *config = font->config;
+        nk_font_init(font, config->size, config->fallback_glyph, atlas->glyphs,
+            config->font, nk_handle_ptr(0));
+    }
+    return pixel;
+}
+
+/* Write a freshly baked RGBA32 atlas to the cache */
+NK_INTERN void
+nk_sdl_save_atlas(nk_hash key, const void *image, int width, int height)
+{
+    struct nk_font_atlas *atlas = &sdl.atlas;
+    struct nk_sdl_atlas_header header;
+    struct nk_font *font;
+    const nk_rune *src = (const nk_rune*)image;
+    nk_byte *alpha;
+    SDL_RWops *file;
+    int i, ok;
+
+    if (!sdl.font_cache) return;
+    alpha = (nk_byte*)atlas->temporary.alloc(atlas->temporary.userdata, 0,
+        (nk_size)width * (nk_size)height);
+    if (!alpha) return;
+    for (i = 0; i < width * height; ++i)
+        alpha[i] = (nk_byte)(src[i] >> 24);
+
+    NK_MEMSET(&header, 0, sizeof(header));
+    NK_MEMCPY(header.magic, NK_SDL_ATLAS_MAGIC, 4);
+    header.key = key;
+    header.width = width;
+    header.height = height;
+    header.glyph_count = atlas->glyph_count;
+    header.custom = atlas->custom;
+    for (font = atlas->fonts; font; font = font->next) header.font_count++;
+
+    file = SDL_RWFromFile(sdl.font_cache, "wb");
+    ok = file && SDL_RWwrite(file, &header, sizeof(header), 1) == 1;
+    for (font = atlas->fonts; ok && font; font = font->next)
+        ok = SDL_RWwrite(file, font->config->font, sizeof(struct nk_baked_font), 1) == 1;
+    ok = ok && SDL_RWwrite(file, atlas->cursors, sizeof(atlas->cursors), 1) == 1 &&
+        SDL_RWwrite(file, atlas->glyphs, sizeof(struct nk_font_glyph), (size_t)atlas->glyph_count)
+            == (size_t)atlas->glyph_count &&
+        SDL_RWwrite(file, alpha, (size_t)width, (size_t)height) == (size_t)height;
+    if (file) SDL_RWclose(file);
+    if (!ok) SDL_Log("could not write font cache %s", sdl.font_cache);
+    atlas->temporary.free(atlas->temporary.userdata, alpha);
+}
+
+/* Cache the baked font atlas in this file; call before nk_sdl_font_stash_end() */
+NK_API void
+nk_sdl_font_cache(const char *path)
+{
+    sdl.font_cache = path;
+}
+
 NK_API void
 nk_sdl_font_stash_begin(struct nk_font_atlas **atlas)
 {
-    nk_font_atlas_init_default(&sdl.atlas);
+    nk_font_atlas_init(&sdl.atlas, &sdl.alloc);
     nk_font_atlas_begin(&sdl.atlas);
     *atlas = &sdl.atlas;
 }
@@ -266,7 +629,18 @@ NK_API void
 nk_sdl_font_stash_end(void)
 {
     const void *image; int w, h;
-    image = nk_font_atlas_bake(&sdl.atlas, &w, &h, NK_FONT_ATLAS_RGBA32);
+    nk_hash key;
+#ifdef NK_INCLUDE_DEFAULT_FONT
+    /* no font added so just use default font, as nk_font_atlas_bake() would */
+    if (!sdl.atlas.font_num)
+        sdl.atlas.default_font = nk_font_atlas_add_default(&sdl.atlas, 13.0f, 0);
+#endif
+    key = nk_sdl_atlas_key(&sdl.atlas);
+    image = nk_sdl_load_atlas(key, &w, &h);
+    if (!image) {
+        image = nk_font_atlas_bake(&sdl.atlas, &w, &h, NK_FONT_ATLAS_RGBA32);
+        if (image) nk_sdl_save_atlas(key, image, w, h);
+    }
     nk_sdl_device_upload_atlas(image, w, h);
     nk_font_atlas_end(&sdl.atlas, nk_handle_ptr(sdl.ogl.font_tex), &sdl.ogl.tex_null);
     if (sdl.atlas.default_font)
@@ -374,6 +748,11 @@ nk_sdl_handle_event(SDL_Event *evt)
         case SDL_MOUSEWHEEL:
             nk_input_scroll(ctx,nk_vec2((float)evt->wheel.x,(float)evt->wheel.y));
             return 1;
+
+        case SDL_RENDER_TARGETS_RESET: /* the overlay's contents are lost */
+        case SDL_RENDER_DEVICE_RESET:
+            sdl.ogl.overlay_dirty = 1;
+            return 0;
     }
     return 0;
 }
@@ -385,8 +764,9 @@ void nk_sdl_shutdown(void)
     nk_font_atlas_clear(&sdl.atlas);
     nk_free(&sdl.ctx);
     SDL_DestroyTexture(dev->font_tex);
+    if (dev->overlay) SDL_DestroyTexture(dev->overlay);
     /* glDeleteTextures(1, &dev->font_tex); */
-    nk_buffer_free(&dev->cmds);
+    if (sdl.arena) sdl.alloc.free(sdl.alloc.userdata, sdl.arena);
     memset(&sdl, 0, sizeof(sdl));
 }
 
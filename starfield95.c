@@ -22,300 +22,4755 @@
  * SOFTWARE.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE   /* sched_setaffinity() for --affinity */
+#endif
+
 #include <SDL2/SDL.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
 #include <time.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+/* Nuklear implementation */
+#define NK_INCLUDE_FIXED_TYPES
+#define NK_INCLUDE_STANDARD_IO
+#define NK_INCLUDE_STANDARD_VARARGS
+#define NK_INCLUDE_DEFAULT_ALLOCATOR
+#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
+#define NK_INCLUDE_FONT_BAKING
+#define NK_INCLUDE_DEFAULT_FONT
+#define NK_IMPLEMENTATION
+#include "nuklear.h"
+#define NK_SDL_RENDERER_IMPLEMENTATION
+#include "nuklear_sdl_renderer.h"
+
+/* Window dimensions */
+#define WINDOW_WIDTH  1280
+#define WINDOW_HEIGHT 720
+
+/* Star count and speed control */
+static int starCount = 10000;
+static float starSlider = 0.02f;  /* 0.02 = 10000 stars, 1.0 = 500000 stars */
+static float speedSlider = 0.5f;  /* Controls star movement speed: 0=stop, 0.5=normal, 1.0=2x */
+static float gSpeedScale = 1.0f;  /* speedSlider * 2, as last applied to the stars */
+
+/* Reset a star if it gets too close to the viewer */
+#define MIN_Z 0.05f
+
+/* Avoid placing a star too close to the center to prevent big streaks */
+#define MIN_RADIUS 0.1f
+
+/* Perspective calculation for dramatic starfield effect */
+#define PERSPECTIVE_SCALE 150.0f
+
+/* Draw trails for stars that are close enough */
+#define NEAR_THRESHOLD 0.3f
+
+static float gNearThreshold = NEAR_THRESHOLD;  /* lowered by the quality governor */
+
+SDL_Window* gWindow = NULL;
+SDL_Renderer* gRenderer = NULL;
+
+struct nk_context* ctx = NULL;
+
+#define BASE_SPEED 0.001f
+#define SPEED_RANGE 0.009f
+
+typedef struct {
+    float x, y, z;    /* 3D position in [-1..1] for x,y, and (0..1] for z */
+    float oldX, oldY; /* Last frame's 2D screen position in pixels */
+    float speed;      /* Speed at which z decreases */
+} Star;
+
+/*
+ * Packed star format: 8 bytes per star instead of the 24 of Star, for
+ * star counts that no longer fit in cache.  x,y in [-1..1] and z in
+ * (0..1] are 16-bit fixed point, which is finer than a pixel even at
+ * 4K.  The previous screen position is not stored: it is re-derived as
+ * the projection of z + speed, i.e. where the star was one frame ago.
+ */
+typedef struct {
+    Sint16 x, y;   /* x,y * PACKED_XY_SCALE */
+    Uint16 z;      /* z * PACKED_Z_SCALE */
+    Uint16 speed;  /* speed * PACKED_SPEED_SCALE */
+} PackedStar;
+
+#define PACKED_XY_SCALE    32767.0f
+#define PACKED_Z_SCALE     65535.0f
+#define MAX_STAR_SPEED     ((BASE_SPEED + SPEED_RANGE) * 2.0f)
+#define PACKED_SPEED_SCALE (65535.0f / MAX_STAR_SPEED)
+
+/*
+ * Structure-of-arrays layout: one array per Star field, so each field
+ * streams through the kernels with unit-stride vector loads.  The
+ * arrays are padded to a multiple of 4 lanes.
+ */
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+    float* oldX;
+    float* oldY;
+    float* speed;
+} StarLanes;
+
+#define SOA_PADDED(n) (((n) + 3) & ~3)
+
+/*
+ * Array-of-structures-of-arrays layout: stars grouped in blocks of
+ * STAR_BLOCK lanes, each block holding every field of its stars.  The
+ * kernels still get unit-stride vector loads inside a block, while a
+ * respawn only touches the few cache lines of its own block.  The
+ * block width is fixed at compile time (-DSTAR_BLOCK=16) and should
+ * match the vector width the kernels are built for.
+ */
+#ifndef STAR_BLOCK
+#define STAR_BLOCK 8
+#endif
+#if STAR_BLOCK % 4 != 0
+#error "STAR_BLOCK must be a multiple of 4"
+#endif
+
+typedef struct {
+    float x[STAR_BLOCK];
+    float y[STAR_BLOCK];
+    float z[STAR_BLOCK];
+    float oldX[STAR_BLOCK];
+    float oldY[STAR_BLOCK];
+    float speed[STAR_BLOCK];
+} StarBlock;
+
+typedef enum {
+    STAR_FORMAT_FULL,    /* Star, 24 bytes (AoS) */
+    STAR_FORMAT_PACKED,  /* PackedStar, 8 bytes (AoS) */
+    STAR_FORMAT_SOA,     /* StarLanes */
+    STAR_FORMAT_AOSOA    /* StarBlock */
+} StarFormat;
+
+static StarFormat gStarFormat = STAR_FORMAT_FULL;
+
+static int gWidth  = WINDOW_WIDTH;
+static int gHeight = WINDOW_HEIGHT;
+
+static float gFPS    = 0.0f;
+static int   gFrames = 0;
+static Uint32 gLastTime = 0;
+
+/* Interval between updates of per-frame figures in the UI */
+#define UI_REFRESH_MS 250
+
+static SDL_RendererInfo gRendererInfo;
+
+static float randFloat() {
+    return (float)rand() / (float)RAND_MAX;
+}
+
+/*
+ * Heap allocations by the app.  Every buffer that can grow while the
+ * frame loop runs is allocated through these, so together with
+ * nk_sdl_allocations() they show when the loop has stopped allocating.
+ * One-off setup and the benchmarks use the plain functions.  Building
+ * with COUNT_ALL_ALLOCATIONS counts the rest of the process too.
+ */
+static SDL_atomic_t gAllocations;
+
+/* Frames --alloc-check lets buffers grow before it starts counting */
+#define ALLOC_WARMUP_FRAMES 120
+
+static void* countedMalloc(size_t bytes) {
+    SDL_AtomicIncRef(&gAllocations);
+    return malloc(bytes);
+}
+
+static void* countedCalloc(size_t count, size_t size) {
+    SDL_AtomicIncRef(&gAllocations);
+    return calloc(count, size);
+}
+
+static void* countedRealloc(void* old, size_t bytes) {
+    SDL_AtomicIncRef(&gAllocations);
+    return realloc(old, bytes);
+}
+
+static Uint64 uiAllocations(void) {
+    return (Uint64)nk_sdl_allocations();
+}
+
+#if defined(COUNT_ALL_ALLOCATIONS)
+#define PROCESS_ALLOCATIONS 1
+#if !defined(__GLIBC__)
+#error "COUNT_ALL_ALLOCATIONS replaces glibc's malloc and needs glibc"
+#endif
+/*
+ * Test build (make alloc-check).  The executable's own malloc family
+ * takes the place of libc's for every library in the process, SDL, the
+ * GPU driver and Nuklear included, and counts each call before passing
+ * it on to glibc's implementation.  Plain atomics, since these run
+ * before SDL is up and on threads it doesn't know about.
+ */
+#include <errno.h>
+
+extern void* __libc_malloc(size_t bytes);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* old, size_t bytes);
+extern void* __libc_memalign(size_t align, size_t bytes);
+extern void  __libc_free(void* p);
+
+static Uint64 gProcessAllocations = 0;
+static Uint64 gProcessFrees = 0;
+
+static void countProcessAllocation(void) {
+    __atomic_fetch_add(&gProcessAllocations, 1, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t bytes) {
+    countProcessAllocation();
+    return __libc_malloc(bytes);
+}
+
+void* calloc(size_t count, size_t size) {
+    countProcessAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* old, size_t bytes) {
+    countProcessAllocation();
+    return __libc_realloc(old, bytes);
+}
+
+void* memalign(size_t align, size_t bytes) {
+    countProcessAllocation();
+    return __libc_memalign(align, bytes);
+}
+
+void* aligned_alloc(size_t align, size_t bytes) {
+    return memalign(align, bytes);
+}
+
+int posix_memalign(void** out, size_t align, size_t bytes) {
+    if (align < sizeof(void*) || (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    void* p = memalign(align, bytes);
+    if (!p) {
+        return ENOMEM;
+    }
+    *out = p;
+    return 0;
+}
+
+void free(void* p) {
+    if (p) {
+        __atomic_fetch_add(&gProcessFrees, 1, __ATOMIC_RELAXED);
+    }
+    __libc_free(p);
+}
+
+/* Every allocation in the process, the app's and the UI's among them */
+static Uint64 heapAllocations(void) {
+    return __atomic_load_n(&gProcessAllocations, __ATOMIC_RELAXED);
+}
+
+static Uint64 heapFrees(void) {
+    return __atomic_load_n(&gProcessFrees, __ATOMIC_RELAXED);
+}
+#else
+#define PROCESS_ALLOCATIONS 0
+
+/* Allocations by the app's growable buffers and the UI */
+static Uint64 heapAllocations(void) {
+    return (Uint64)SDL_AtomicGet(&gAllocations) + uiAllocations();
+}
+
+static Uint64 heapFrees(void) {
+    return 0;   /* only the test build sees them */
+}
+#endif
+
+/*
+ * Worker pool.  parallelFor() splits [0, n) into chunks that the main
+ * thread and the workers claim from a shared counter until none are
+ * left, and returns once every chunk is done.  The pool starts on first
+ * use with one worker per extra CPU (or --threads); with no workers the
+ * range simply runs on the calling thread.  The simulation thread and
+ * the render thread both use it; whichever finds it busy waits for the
+ * other's range to finish and then has every worker for its own, since
+ * running it alone would leave that thread's work on one CPU.
+ *
+ * With --affinity (Linux only) each worker is pinned to one CPU of the
+ * set, and parallelForSlices() hands every worker the same fixed slice
+ * of a range each time.  The star arrays are first touched through it
+ * too (see reallocStars), so on a NUMA host each worker updates stars
+ * that live on its own node.
+ */
+#define MAX_WORKERS 63
+
+typedef void (*RangeFn)(void* job, int first, int last);
+
+/* A set of CPU numbers below MAX_CPUS */
+#define MAX_CPUS 1024
+
+typedef struct {
+    int    count;
+    Uint64 bits[MAX_CPUS / 64];
+} CpuSet;
+
+static int     gWorkerCount = -1;   /* -1 = one per extra CPU, or per CPU of the set */
+static CpuSet  gAffinity;           /* CPUs to pin workers to; empty leaves them to the OS */
+
+static int cpuSetHas(const CpuSet* set, int cpu) {
+    return (set->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+static void cpuSetAdd(CpuSet* set, int cpu) {
+    if (!cpuSetHas(set, cpu)) {
+        set->bits[cpu / 64] |= (Uint64)1 << (cpu % 64);
+        set->count++;
+    }
+}
+
+/* The CPUs in both sets */
+static CpuSet cpuSetAnd(const CpuSet* a, const CpuSet* b) {
+    CpuSet set;
+    set.count = 0;
+    for (int w = 0; w < MAX_CPUS / 64; w++) {
+        set.bits[w] = a->bits[w] & b->bits[w];
+        set.count += __builtin_popcountll(set.bits[w]);
+    }
+    return set;
+}
+
+/* The n-th CPU of a non-empty set, wrapping around */
+static int nthCpu(const CpuSet* set, int n) {
+    n %= set->count;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (cpuSetHas(set, cpu) && n-- == 0) {
+            return cpu;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Parse a cpulist such as "0-7,16-23" (trailing whitespace allowed, as
+ * sysfs ends its lists with a newline).  Returns 0 for anything else,
+ * or a list with no CPUs in it.
+ */
+static int parseCpuList(const char* list, CpuSet* set) {
+    const char* p = list;
+    memset(set, 0, sizeof(*set));
+    for (;;) {
+        if (*p < '0' || *p > '9') {
+            return 0;
+        }
+        char* end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            if (*p < '0' || *p > '9') {
+                return 0;
+            }
+            hi = strtol(p, &end, 10);
+        }
+        if (lo > hi || hi >= MAX_CPUS) {
+            return 0;
+        }
+        for (long cpu = lo; cpu <= hi; cpu++) {
+            cpuSetAdd(set, (int)cpu);
+        }
+        p = end;
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+    while (*p == ' ' || *p == '\n' || *p == '\t') {
+        p++;
+    }
+    return *p == '\0' && set->count > 0;
+}
+
+/* Whether this process may run on cpu */
+static int cpuAvailable(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    return cpu < CPU_SETSIZE && sched_getaffinity(0, sizeof(set), &set) == 0 &&
+           CPU_ISSET(cpu, &set);
+#else
+    (void)cpu;
+    return 1;
+#endif
+}
+
+/* Restrict the calling thread to one CPU */
+static int pinThread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpu >= CPU_SETSIZE) {
+        return 0;
+    }
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return 0;
+#endif
+}
+
+static struct {
+    SDL_Thread*  threads[MAX_WORKERS];
+    int          count;
+    int          started;
+    int          quit;
+    SDL_sem*     start[MAX_WORKERS]; /* one per worker, so no worker takes two
+                                        wake-ups (and two fixed slices) */
+    SDL_sem*     done;     /* posted by each worker when it runs out of chunks */
+    SDL_mutex*   lock;     /* held while a parallelFor() owns the workers */
+    SDL_atomic_t next;     /* first index of the next unclaimed chunk */
+    RangeFn      fn;
+    void*        job;
+    int          n;
+    int          chunk;
+    int          fixed;    /* worker w runs slice w of count, the caller none */
+} pool;
+
+/* Run this thread's share of the job; worker is -1 for the calling thread */
+static void runChunks(int worker) {
+    if (pool.fixed) {
+        if (worker >= 0) {
+            int first = (int)((Sint64)pool.n * worker / pool.count);
+            int last = (int)((Sint64)pool.n * (worker + 1) / pool.count);
+            if (first < last) {
+                pool.fn(pool.job, first, last);
+            }
+        }
+        return;
+    }
+    for (;;) {
+        int first = SDL_AtomicAdd(&pool.next, pool.chunk);
+        if (first >= pool.n) {
+            break;
+        }
+        pool.fn(pool.job, first, SDL_min(first + pool.chunk, pool.n));
+    }
+}
+
+static int workerMain(void* data) {
+    int worker = (int)(intptr_t)data;
+    if (gAffinity.count) {
+        int cpu = nthCpu(&gAffinity, worker);
+        if (!pinThread(cpu)) {
+            printf("Could not pin worker %d to CPU %d!\n", worker, cpu);
+        }
+    }
+    for (;;) {
+        SDL_SemWait(pool.start[worker]);
+        if (pool.quit) {
+            break;
+        }
+        runChunks(worker);
+        SDL_SemPost(pool.done);
+    }
+    return 0;
+}
+
+static void stopWorkers(void) {
+    pool.quit = 1;
+    for (int i = 0; i < pool.count; i++) {
+        SDL_SemPost(pool.start[i]);
+    }
+    for (int i = 0; i < pool.count; i++) {
+        SDL_WaitThread(pool.threads[i], NULL);
+    }
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        if (pool.start[i]) SDL_DestroySemaphore(pool.start[i]);
+    }
+    if (pool.done) SDL_DestroySemaphore(pool.done);
+    if (pool.lock) SDL_DestroyMutex(pool.lock);
+    memset(&pool, 0, sizeof(pool));
+}
+
+static void startWorkers(void) {
+    int want = gWorkerCount >= 0 ? gWorkerCount
+             : gAffinity.count ? gAffinity.count : SDL_GetCPUCount() - 1;
+    want = SDL_clamp(want, 0, MAX_WORKERS);
+
+    pool.started = 1;
+    pool.done = SDL_CreateSemaphore(0);
+    pool.lock = SDL_CreateMutex();
+    if (!pool.done || !pool.lock) {
+        printf("Could not create worker pool! SDL_Error: %s\n", SDL_GetError());
+        return;
+    }
+    for (; pool.count < want; pool.count++) {
+        pool.start[pool.count] = SDL_CreateSemaphore(0);
+        if (!pool.start[pool.count]) {
+            printf("Could not create worker pool! SDL_Error: %s\n", SDL_GetError());
+            break;
+        }
+        pool.threads[pool.count] = SDL_CreateThread(workerMain, "worker",
+                                                    (void*)(intptr_t)pool.count);
+        if (!pool.threads[pool.count]) {
+            printf("Could not create worker thread! SDL_Error: %s\n", SDL_GetError());
+            break;
+        }
+    }
+}
+
+static void runParallel(int n, RangeFn fn, void* job, int fixed) {
+    if (!pool.started) {
+        startWorkers();
+    }
+    if (pool.count == 0 || n < 2) {
+        if (n > 0) {
+            fn(job, 0, n);
+        }
+        return;
+    }
+
+    SDL_LockMutex(pool.lock);
+
+    pool.fn = fn;
+    pool.job = job;
+    pool.n = n;
+    pool.chunk = SDL_max(1, n / (4 * (pool.count + 1)));
+    pool.fixed = fixed;
+    SDL_AtomicSet(&pool.next, 0);
+    for (int i = 0; i < pool.count; i++) {
+        SDL_SemPost(pool.start[i]);
+    }
+    runChunks(-1);
+    for (int i = 0; i < pool.count; i++) {
+        SDL_SemWait(pool.done);
+    }
+    SDL_UnlockMutex(pool.lock);
+}
+
+/* Run fn over [0, n) on every thread, in chunks of about n / (4 * threads) */
+static void parallelFor(int n, RangeFn fn, void* job) {
+    runParallel(n, fn, job, 0);
+}
+
+/* Same, but with pinned workers each worker always gets the same slice of n */
+static void parallelForSlices(int n, RangeFn fn, void* job) {
+    runParallel(n, fn, job, gAffinity.count != 0);
+}
+
+static Star* stars = NULL;
+static PackedStar* packedStars = NULL;
+static StarLanes soaStars;
+static StarBlock* blockStars = NULL;
+
+/*
+ * Spawn a batch of stars far away, uniformly distributed over the
+ * [-1..1] square minus the MIN_RADIUS disk around the center.
+ *
+ * Instead of rejection sampling we sample the region directly: by
+ * symmetry it is 8 copies of the octant 0 <= y <= x, and a point in
+ * the octant is written as (s, s*t) with slope t in [0..1] and s in
+ * [smin(t)..1].  The area element is s ds dt, so t has density
+ * proportional to 1 - a/(1+t^2) (a = MIN_RADIUS^2) and, given t, s^2
+ * is uniform.  Three random bits then pick one of the 8 octants.
+ * Every star costs the same fixed amount of work and the inner loop
+ * has no branches.
+ */
+#define SPAWN_BATCH 256
+
+/* atan() on [0..1], max error ~1e-5 rad (scaled by MIN_RADIUS^2 below) */
+static inline float atanUnit(float t) {
+    float t2 = t * t;
+    return t * (0.99997726f + t2 * (-0.33262347f + t2 * (0.19354346f +
+           t2 * (-0.11643287f + t2 * (0.05265332f + t2 * -0.01172120f)))));
+}
+
+/* The globals a spawned record bakes in, captured once per batch */
+typedef struct SpawnParams {
+    float speedScale;
+    float cx, cy;
+} SpawnParams;
+
+static inline SpawnParams spawnParams(void) {
+    SpawnParams p;
+    p.speedScale = gSpeedScale;
+    p.cx = gWidth  / 2.0f;
+    p.cy = gHeight / 2.0f;
+    return p;
+}
+
+/* Branch-free transform of one set of uniform draws into a star record */
+static inline void makeStar(Star* out, const SpawnParams* p,
+                            float zr, float ur, float vr, float sr, int b) {
+    const float a = MIN_RADIUS * MIN_RADIUS;
+    const float tScale = 1.0f - a * 0.78539816f;  /* 1 - a*pi/4 */
+
+    /* Random z in [0.1..1.0], i.e. "distance." */
+    float z = 0.1f + 0.9f * zr;
+
+    /* Invert the slope CDF t - a*atan(t) = u*(1 - a*pi/4) */
+    float target = ur * tScale;
+    float t = target;
+    t = target + a * atanUnit(t);
+    t = target + a * atanUnit(t);
+    t = target + a * atanUnit(t);
+
+    /* s^2 uniform in [smin^2..1] */
+    float smin2 = a / (1.0f + t * t);
+    float s = sqrtf(smin2 + vr * (1.0f - smin2));
+    float ox = s;
+    float oy = s * t;
+
+    /* Fold the octant sample out to the full square */
+    float sx = (float)(1 - 2 * ((b >> 1) & 1));
+    float sy = (float)(1 - 2 * ((b >> 2) & 1));
+    float x = ((b & 1) ? oy : ox) * sx;
+    float y = ((b & 1) ? ox : oy) * sy;
+
+    out->x = x;
+    out->y = y;
+    out->z = z;
+
+    /* Speed controlled by slider: 0=stop, 0.5=normal, 1.0=2x */
+    out->speed = (BASE_SPEED + SPEED_RANGE * sr) * p->speedScale;
+
+    /*
+     * Set oldX, oldY to the star's current screen position,
+     * so it doesn't produce a big line in the first frame.
+     */
+    float factor = PERSPECTIVE_SCALE / z;
+    out->oldX = p->cx + (x * factor);
+    out->oldY = p->cy + (y * factor);
+}
+
+/* Uses rand(), so only ever call this from the thread driving the update */
+static void spawnStars(Star* dst, int count) {
+    const SpawnParams p = spawnParams();
+
+    float zr[SPAWN_BATCH], ur[SPAWN_BATCH], vr[SPAWN_BATCH], sr[SPAWN_BATCH];
+    int   bits[SPAWN_BATCH];
+
+    for (int base = 0; base < count; base += SPAWN_BATCH) {
+        int n = count - base;
+        if (n > SPAWN_BATCH) n = SPAWN_BATCH;
+
+        /* 1) Draw all random numbers for the batch up front. */
+        for (int i = 0; i < n; i++) {
+            zr[i]   = randFloat();
+            ur[i]   = randFloat();
+            vr[i]   = randFloat();
+            sr[i]   = randFloat();
+            bits[i] = rand();
+        }
+
+        /* 2) Branch-free transform into star records. */
+        Star* out = dst + base;
+        for (int i = 0; i < n; i++) {
+            makeStar(&out[i], &p, zr[i], ur[i], vr[i], sr[i], bits[i]);
+        }
+    }
+}
+
+static inline PackedStar packStar(const Star* star) {
+    PackedStar p;
+    p.x = (Sint16)(star->x * PACKED_XY_SCALE + (star->x < 0.0f ? -0.5f : 0.5f));
+    p.y = (Sint16)(star->y * PACKED_XY_SCALE + (star->y < 0.0f ? -0.5f : 0.5f));
+    p.z = (Uint16)(star->z * PACKED_Z_SCALE + 0.5f);
+    p.speed = (Uint16)(star->speed * PACKED_SPEED_SCALE + 0.5f);
+    return p;
+}
+
+static void spawnPackedStars(PackedStar* dst, int count) {
+    Star batch[SPAWN_BATCH];
+
+    for (int base = 0; base < count; base += SPAWN_BATCH) {
+        int n = count - base;
+        if (n > SPAWN_BATCH) n = SPAWN_BATCH;
+
+        spawnStars(batch, n);
+        for (int i = 0; i < n; i++) {
+            dst[base + i] = packStar(&batch[i]);
+        }
+    }
+}
+
+static inline StarLanes blockLanes(StarBlock* block) {
+    StarLanes l = { block->x, block->y, block->z, block->oldX, block->oldY, block->speed };
+    return l;
+}
+
+static inline void setLaneStar(const StarLanes* l, int i, const Star* star) {
+    l->x[i] = star->x;
+    l->y[i] = star->y;
+    l->z[i] = star->z;
+    l->oldX[i] = star->oldX;
+    l->oldY[i] = star->oldY;
+    l->speed[i] = star->speed;
+}
+
+static void spawnLaneStars(const StarLanes* l, int first, int count) {
+    Star batch[SPAWN_BATCH];
+
+    for (int base = 0; base < count; base += SPAWN_BATCH) {
+        int n = count - base;
+        if (n > SPAWN_BATCH) n = SPAWN_BATCH;
+
+        spawnStars(batch, n);
+        for (int i = 0; i < n; i++) {
+            setLaneStar(l, first + base + i, &batch[i]);
+        }
+    }
+}
+
+static void spawnBlockStars(StarBlock* blocks, int first, int count) {
+    int end = first + count;
+
+    for (int i = first; i < end; ) {
+        int lane = i % STAR_BLOCK;
+        int n = SDL_min(STAR_BLOCK - lane, end - i);
+        StarLanes l = blockLanes(&blocks[i / STAR_BLOCK]);
+        spawnLaneStars(&l, lane, n);
+        i += n;
+    }
+}
+
+/*
+ * The update is split into runs of UPDATE_GRAIN stars for the worker
+ * pool.  A run is a whole number of vectors and AoSoA blocks, so the
+ * kernels never see a partial vector except at the very end.
+ */
+#define UPDATE_GRAIN 8192
+#if UPDATE_GRAIN % STAR_BLOCK != 0
+#error "UPDATE_GRAIN must be a multiple of STAR_BLOCK"
+#endif
+
+typedef struct {
+    Uint8*       dst;
+    const Uint8* src;
+    size_t       oldBytes;
+    size_t       bytes;
+    size_t       runBytes;
+} TouchJob;
+
+static void touchRuns(void* data, int first, int last) {
+    const TouchJob* t = (const TouchJob*)data;
+    size_t from = first * t->runBytes;
+    size_t to = SDL_min(last * t->runBytes, t->bytes);
+    size_t copied = SDL_max(from, SDL_min(to, t->oldBytes));
+
+    if (copied > from) {
+        memcpy(t->dst + from, t->src + from, copied - from);
+    }
+    memset(t->dst + copied, 0, to - copied);
+}
+
+/*
+ * realloc() for a star array whose runs of UPDATE_GRAIN stars take
+ * runBytes each.  With pinned workers the new block is first written
+ * run by run through parallelForSlices(), the same way the update will
+ * walk it, so its pages are placed on the nodes of the workers that
+ * use them.  Stars past the old size come back zeroed.
+ */
+static void* reallocStars(void* old, size_t oldBytes, size_t bytes, size_t runBytes) {
+    if (!gAffinity.count) {
+        return countedRealloc(old, bytes);
+    }
+    Uint8* block = (Uint8*)countedMalloc(bytes);
+    if (!block) {
+        return NULL;
+    }
+    TouchJob t = { block, (const Uint8*)old, SDL_min(oldBytes, bytes), bytes, runBytes };
+    parallelForSlices((int)((bytes + runBytes - 1) / runBytes), touchRuns, &t);
+    free(old);
+    return block;
+}
+
+static int reallocLanes(StarLanes* l, int oldCount, int count) {
+    float** fields[] = { &l->x, &l->y, &l->z, &l->oldX, &l->oldY, &l->speed };
+
+    for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++) {
+        float* field = (float*)reallocStars(*fields[f], oldCount * sizeof(float),
+                                            count * sizeof(float), UPDATE_GRAIN * sizeof(float));
+        if (!field) {
+            return 0;
+        }
+        *fields[f] = field;
+    }
+    return 1;
+}
+
+static int allocateStars(int count) {
+    switch (gStarFormat) {
+    case STAR_FORMAT_PACKED: {
+        PackedStar* newStars = (PackedStar*)reallocStars(packedStars,
+            starCount * sizeof(PackedStar), count * sizeof(PackedStar),
+            UPDATE_GRAIN * sizeof(PackedStar));
+        if (!newStars) {
+            return 0;
+        }
+
+        /* Initialize new stars if array grew */
+        if (count > starCount) {
+            spawnPackedStars(newStars + starCount, count - starCount);
+        }
+
+        packedStars = newStars;
+        break;
+    }
+    case STAR_FORMAT_SOA: {
+        int padded = SOA_PADDED(count);
+        if (!reallocLanes(&soaStars, SOA_PADDED(starCount), padded)) {
+            return 0;
+        }
+
+        /* Initialize new stars, and the padding lanes, if arrays grew */
+        if (count > starCount) {
+            spawnLaneStars(&soaStars, starCount, padded - starCount);
+        }
+        break;
+    }
+    case STAR_FORMAT_AOSOA: {
+        int blocks = (count + STAR_BLOCK - 1) / STAR_BLOCK;
+        int oldBlocks = (starCount + STAR_BLOCK - 1) / STAR_BLOCK;
+        StarBlock* newBlocks = (StarBlock*)reallocStars(blockStars,
+            oldBlocks * sizeof(StarBlock), blocks * sizeof(StarBlock),
+            UPDATE_GRAIN / STAR_BLOCK * sizeof(StarBlock));
+        if (!newBlocks) {
+            return 0;
+        }
+
+        /* Initialize new stars, and the rest of the last block, if it grew */
+        if (count > starCount) {
+            spawnBlockStars(newBlocks, starCount, blocks * STAR_BLOCK - starCount);
+        }
+
+        blockStars = newBlocks;
+        break;
+    }
+    default: {
+        Star* newStars = (Star*)reallocStars(stars, starCount * sizeof(Star),
+                                             count * sizeof(Star), UPDATE_GRAIN * sizeof(Star));
+        if (!newStars) {
+            return 0;
+        }
+
+        /* Initialize new stars if array grew */
+        if (count > starCount) {
+            spawnStars(newStars + starCount, count - starCount);
+        }
+
+        stars = newStars;
+        break;
+    }
+    }
+
+    starCount = count;
+    return 1;
+}
+
+static void freeStars(void) {
+    free(stars);
+    free(packedStars);
+    free(soaStars.x);
+    free(soaStars.y);
+    free(soaStars.z);
+    free(soaStars.oldX);
+    free(soaStars.oldY);
+    free(soaStars.speed);
+    free(blockStars);
+    stars = NULL;
+    packedStars = NULL;
+    memset(&soaStars, 0, sizeof(soaStars));
+    blockStars = NULL;
+    starCount = 0;
+}
+
+/*
+ * Respawn pool: a ring buffer of ready-to-use star records, refilled
+ * in bulk by spawnStars() once per frame.  Respawning a star in the
+ * update loop is then a plain record copy.  Records bake in the
+ * current speed and window size, so the pool is flushed whenever
+ * either of them changes.  The update may run on several threads, so
+ * records are claimed through an atomic counter and only retired from
+ * the ring by the next refill.
+ *
+ * The ring grows to twice the largest number of respawns seen in one
+ * frame, so in steady state the workers never run dry.  If they do
+ * anyway (the first frames, or a burst) the overflow is spawned from a
+ * small hash-seeded generator instead: rand() is not thread-safe and
+ * must never be reached from a worker.
+ */
+#define RESPAWN_POOL_MIN 16384    /* must be a power of two */
+#define RESPAWN_POOL_MAX (1 << 20)
+
+static Star* respawnPool  = NULL;
+static int   respawnSize  = 0;  /* capacity, a power of two */
+static int   respawnHead  = 0;  /* first ready record */
+static int   respawnCount = 0;  /* number of ready records */
+static SDL_atomic_t respawnTaken;  /* records claimed since the last refill */
+static SpawnParams respawnParams;  /* what the overflow path spawns with */
+static Uint32 respawnSeed = 0;
+
+static void growRespawnPool(int demand) {
+    int size = respawnSize ? respawnSize : RESPAWN_POOL_MIN;
+    while (size < 2 * demand && size < RESPAWN_POOL_MAX) {
+        size *= 2;
+    }
+    if (size == respawnSize) {
+        return;
+    }
+
+    Star* pool = (Star*)countedMalloc(size * sizeof(Star));
+    if (!pool) {
+        printf("Could not allocate a respawn pool of %d stars!\n", size);
+        return;
+    }
+    free(respawnPool);
+    respawnPool = pool;
+    respawnSize = size;
+    respawnHead = 0;
+    respawnCount = 0;
+}
+
+static void refillRespawnPool(void) {
+    int demand = SDL_AtomicGet(&respawnTaken);
+    int taken = SDL_min(demand, respawnCount);
+    SDL_AtomicSet(&respawnTaken, 0);
+
+    if (respawnSize == 0 || 2 * demand > respawnSize) {
+        growRespawnPool(demand);
+    }
+
+    int mask = respawnSize - 1;
+    respawnHead = (respawnHead + taken) & mask;
+    respawnCount -= taken;
+
+    int room = respawnSize - respawnCount;
+    int tail = (respawnHead + respawnCount) & mask;
+
+    /* The free slots are at most two contiguous runs around the wrap */
+    int run = respawnSize - tail;
+    if (run > room) run = room;
+    spawnStars(&respawnPool[tail], run);
+    spawnStars(&respawnPool[0], room - run);
+
+    respawnCount = respawnSize;
+    respawnParams = spawnParams();
+    respawnSeed += 0x9E3779B9u;
+}
+
+static void flushRespawnPool(void) {
+    respawnCount = 0;
+    SDL_AtomicSet(&respawnTaken, 0);
+}
+
+/* 32-bit integer hash finalizer, decorrelates consecutive tickets */
+static inline Uint32 hashU32(Uint32 x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline Uint32 xorshift32(Uint32* state) {
+    Uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/* Uniform float in [0..1] from the top 24 bits of the generator */
+static inline float xorshiftFloat(Uint32* state) {
+    return (float)(xorshift32(state) >> 8) * (1.0f / 16777215.0f);
+}
+
+/* Thread-safe spawn of one star, seeded only by its ticket */
+static void spawnHashedStar(Star* out, const SpawnParams* p, Uint32 ticket) {
+    Uint32 state = hashU32(ticket) | 1;
+    float zr = xorshiftFloat(&state);
+    float ur = xorshiftFloat(&state);
+    float vr = xorshiftFloat(&state);
+    float sr = xorshiftFloat(&state);
+    int bits = (int)(xorshift32(&state) >> 8);
+    makeStar(out, p, zr, ur, vr, sr, bits);
+}
+
+static const Star* nextRespawn(Star* spare) {
+    int k = SDL_AtomicAdd(&respawnTaken, 1);
+
+    /* Only taken if a single frame respawns more than the whole pool */
+    if (k >= respawnCount) {
+        spawnHashedStar(spare, &respawnParams, (Uint32)k ^ respawnSeed);
+        return spare;
+    }
+    return &respawnPool[(respawnHead + k) & (respawnSize - 1)];
+}
+
+static void initStar(Star* star) {
+    Star spare;
+    *star = *nextRespawn(&spare);
+}
+
+static void initPackedStar(PackedStar* star) {
+    Star spare;
+    *star = packStar(nextRespawn(&spare));
+}
+
+static int initStars() {
+    /* Grow from an empty array so every star gets spawned */
+    int count = starCount;
+    starCount = 0;
+    return allocateStars(count);
+}
+
+/*
+ * SIMD helpers.  GCC and Clang vector extensions give 4-wide float
+ * math that maps to SSE on x86 and NEON on ARM from one code path.
+ */
+typedef float  v4f __attribute__((vector_size(16)));
+typedef Sint32 v4i __attribute__((vector_size(16)));
+typedef Uint32 v4u __attribute__((vector_size(16)));
+typedef Sint16 v8s __attribute__((vector_size(16)));   /* 2 pixels of 16-bit channels */
+
+#define V4_LANES 4
+
+static inline v4f v4fFromInt(v4i v) { return __builtin_convertvector(v, v4f); }
+static inline v4i v4iFromFloat(v4f v) { return __builtin_convertvector(v, v4i); }
+
+static inline v4f v4fSelect(v4i mask, v4f a, v4f b) {
+    return (v4f)((mask & (v4i)a) | (~mask & (v4i)b));
+}
+
+static inline v4f v4fClamp(v4f v, float lo, float hi) {
+    v = v4fSelect(v < lo, (v4f){ lo, lo, lo, lo }, v);
+    return v4fSelect(v > hi, (v4f){ hi, hi, hi, hi }, v);
+}
+
+static inline v4f v4fLoad(const float* p) {
+    v4f v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void v4fStore(float* p, v4f v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+/* Gather one float field of 4 consecutive stars */
+#define STAR_LANES(p, field) \
+    ((v4f){ (p)[0].field, (p)[1].field, (p)[2].field, (p)[3].field })
+
+/*
+ * A packed star is two 32-bit words, x | y << 16 and z | speed << 16.
+ * Split 4 consecutive stars into one vector of each word with a pair
+ * of shuffles, and interleave them back the same way.
+ */
+static inline void v4uLoadPacked(const PackedStar* p, v4u* xy, v4u* zs) {
+#if defined(__SSE__)
+    __m128 a = _mm_loadu_ps((const float*)p);
+    __m128 b = _mm_loadu_ps((const float*)&p[2]);
+    *xy = (v4u)_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    *zs = (v4u)_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+#elif defined(__ARM_NEON)
+    uint32x4x2_t v = vld2q_u32((const uint32_t*)p);
+    *xy = (v4u)v.val[0];
+    *zs = (v4u)v.val[1];
+#else
+    for (int k = 0; k < 4; k++) {
+        (*xy)[k] = (Uint16)p[k].x | ((Uint32)(Uint16)p[k].y << 16);
+        (*zs)[k] = p[k].z | ((Uint32)p[k].speed << 16);
+    }
+#endif
+}
+
+static inline void v4uStorePacked(PackedStar* p, v4u xy, v4u zs) {
+#if defined(__SSE__)
+    _mm_storeu_ps((float*)p, _mm_unpacklo_ps((__m128)xy, (__m128)zs));
+    _mm_storeu_ps((float*)&p[2], _mm_unpackhi_ps((__m128)xy, (__m128)zs));
+#elif defined(__ARM_NEON)
+    uint32x4x2_t v = { { (uint32x4_t)xy, (uint32x4_t)zs } };
+    vst2q_u32((uint32_t*)p, v);
+#else
+    for (int k = 0; k < 4; k++) {
+        p[k].x = (Sint16)(xy[k] & 0xFFFFu);
+        p[k].y = (Sint16)(xy[k] >> 16);
+        p[k].z = (Uint16)(zs[k] & 0xFFFFu);
+        p[k].speed = (Uint16)(zs[k] >> 16);
+    }
+#endif
+}
+
+/*
+ * Reciprocal depth with selectable precision (--rcp).  A hardware
+ * estimate is refined with Newton-Raphson steps r' = r * (2 - z*r),
+ * each of which roughly doubles the number of correct bits.
+ */
+typedef enum {
+    RCP_EXACT,   /* IEEE divide */
+    RCP_FAST,    /* estimate + 1 Newton step, at least 16 bits */
+    RCP_PRECISE  /* estimate + 2 Newton steps, full float precision */
+} RcpPrecision;
+
+static RcpPrecision gRcpPrecision = RCP_FAST;
+
+static inline v4f v4fRcpEstimate(v4f z) {
+#if defined(__SSE__)
+    return (v4f)_mm_rcp_ps((__m128)z);            /* 12 bits */
+#elif defined(__ARM_NEON)
+    return (v4f)vrecpeq_f32((float32x4_t)z);      /* 8 bits */
+#else
+    /* Exponent bit trick plus one Newton step, about 8 bits */
+    v4f r = (v4f)(0x7EF311C7 - (v4i)z);
+    return r * (2.0f - z * r);
+#endif
+}
+
+static inline v4f v4fRcp(v4f z, RcpPrecision precision) {
+    if (precision == RCP_EXACT) {
+        return 1.0f / z;
+    }
+    v4f r = v4fRcpEstimate(z);
+    r = r * (2.0f - z * r);
+    if (precision == RCP_PRECISE) {
+        r = r * (2.0f - z * r);
+    }
+    return r;
+}
+
+/*
+ * Narrow 4 vectors of channel values to bytes, saturating to 0..255,
+ * and store them as 4 packed pixels, lane order matching byte order in
+ * memory.
+ */
+static inline void v4iStorePixels(Uint32* out, v4i a, v4i b, v4i c, v4i d) {
+#if defined(__SSE2__)
+    __m128i ab = _mm_packs_epi32((__m128i)a, (__m128i)b);
+    __m128i cd = _mm_packs_epi32((__m128i)c, (__m128i)d);
+    _mm_storeu_si128((__m128i*)out, _mm_packus_epi16(ab, cd));
+#elif defined(__ARM_NEON)
+    int16x8_t ab = vcombine_s16(vmovn_s32((int32x4_t)a), vmovn_s32((int32x4_t)b));
+    int16x8_t cd = vcombine_s16(vmovn_s32((int32x4_t)c), vmovn_s32((int32x4_t)d));
+    vst1q_u8((uint8_t*)out, vcombine_u8(vqmovun_s16(ab), vqmovun_s16(cd)));
+#else
+    const v4i px[4] = { a, b, c, d };
+    for (int k = 0; k < 4; k++) {
+        Uint8 bytes[4];
+        for (int ch = 0; ch < 4; ch++) {
+            bytes[ch] = (Uint8)SDL_clamp(px[k][ch], 0, 255);
+        }
+        memcpy(&out[k], bytes, sizeof(bytes));
+    }
+#endif
+}
+
+/* The reverse: widen 4 packed pixels to one vector of channel values each */
+static inline void v4iLoadPixels(const Uint32* in, v4i px[4]) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i p = _mm_loadu_si128((const __m128i*)in);
+    __m128i lo = _mm_unpacklo_epi8(p, zero);
+    __m128i hi = _mm_unpackhi_epi8(p, zero);
+    px[0] = (v4i)_mm_unpacklo_epi16(lo, zero);
+    px[1] = (v4i)_mm_unpackhi_epi16(lo, zero);
+    px[2] = (v4i)_mm_unpacklo_epi16(hi, zero);
+    px[3] = (v4i)_mm_unpackhi_epi16(hi, zero);
+#elif defined(__ARM_NEON)
+    uint8x16_t p = vld1q_u8((const uint8_t*)in);
+    uint16x8_t lo = vmovl_u8(vget_low_u8(p));
+    uint16x8_t hi = vmovl_u8(vget_high_u8(p));
+    px[0] = (v4i)vmovl_u16(vget_low_u16(lo));
+    px[1] = (v4i)vmovl_u16(vget_high_u16(lo));
+    px[2] = (v4i)vmovl_u16(vget_low_u16(hi));
+    px[3] = (v4i)vmovl_u16(vget_high_u16(hi));
+#else
+    for (int k = 0; k < 4; k++) {
+        Uint8 bytes[4];
+        memcpy(bytes, &in[k], sizeof(bytes));
+        px[k] = (v4i){ bytes[0], bytes[1], bytes[2], bytes[3] };
+    }
+#endif
+}
+
+/*
+ * Narrower lanes for pixel filters whose sums fit in 16 bits: 4 packed
+ * pixels widen to two vectors of 2 pixels each, and narrow back with
+ * the same saturation as v4iStorePixels().
+ */
+static inline void v8sLoadPixels(const Uint32* in, v8s* lo, v8s* hi) {
+#if defined(__SSE2__)
+    __m128i p = _mm_loadu_si128((const __m128i*)in);
+    *lo = (v8s)_mm_unpacklo_epi8(p, _mm_setzero_si128());
+    *hi = (v8s)_mm_unpackhi_epi8(p, _mm_setzero_si128());
+#elif defined(__ARM_NEON)
+    uint8x16_t p = vld1q_u8((const uint8_t*)in);
+    *lo = (v8s)vmovl_u8(vget_low_u8(p));
+    *hi = (v8s)vmovl_u8(vget_high_u8(p));
+#else
+    Uint8 bytes[16];
+    memcpy(bytes, in, sizeof(bytes));
+    for (int c = 0; c < 8; c++) {
+        (*lo)[c] = bytes[c];
+        (*hi)[c] = bytes[8 + c];
+    }
+#endif
+}
+
+static inline void v8sStorePixels(Uint32* out, v8s lo, v8s hi) {
+#if defined(__SSE2__)
+    _mm_storeu_si128((__m128i*)out, _mm_packus_epi16((__m128i)lo, (__m128i)hi));
+#elif defined(__ARM_NEON)
+    vst1q_u8((uint8_t*)out, vcombine_u8(vqmovun_s16((int16x8_t)lo), vqmovun_s16((int16x8_t)hi)));
+#else
+    Uint8 bytes[16];
+    for (int c = 0; c < 8; c++) {
+        bytes[c] = (Uint8)SDL_clamp(lo[c], 0, 255);
+        bytes[8 + c] = (Uint8)SDL_clamp(hi[c], 0, 255);
+    }
+    memcpy(out, bytes, sizeof(bytes));
+#endif
+}
+
+/* Two pixels of 32-bit channels (each fitting 16 bits) side by side */
+static inline v8s v8sFromPixels(v4i a, v4i b) {
+#if defined(__SSE2__)
+    return (v8s)_mm_packs_epi32((__m128i)a, (__m128i)b);
+#elif defined(__ARM_NEON)
+    return (v8s)vcombine_s16(vmovn_s32((int32x4_t)a), vmovn_s32((int32x4_t)b));
+#else
+    return (v8s){ a[0], a[1], a[2], a[3], b[0], b[1], b[2], b[3] };
+#endif
+}
+
+/* The two pixels of a vector (non-negative channels) added together */
+static inline v4i v4iAddPixels(v8s v) {
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    return (v4i)_mm_add_epi32(_mm_unpacklo_epi16((__m128i)v, zero),
+                              _mm_unpackhi_epi16((__m128i)v, zero));
+#elif defined(__ARM_NEON)
+    return (v4i)vaddl_s16(vget_low_s16((int16x8_t)v), vget_high_s16((int16x8_t)v));
+#else
+    return (v4i){ v[0] + v[4], v[1] + v[5], v[2] + v[6], v[3] + v[7] };
+#endif
+}
+
+/*
+ * Screen coordinates are clamped to a guard band around the window
+ * before the integer conversion, so extreme values can never overflow.
+ * Each coordinate is clamped on its own, so a clamped segment would
+ * change slope, but live stars never reach the band: with z >= MIN_Z
+ * they stay within PERSPECTIVE_SCALE / MIN_Z pixels of the center.
+ */
+#define SCREEN_GUARD 16384.0f
+
+/*
+ * Per-frame draw list: far stars as points, near stars as line
+ * segments (lines[2k] -> lines[2k+1]).  The projection kernels below
+ * fill it for whichever star format is active, and render() submits it.
+ * Stars beyond the far LOD depth are collected separately, growing
+ * down from the end of the points array, and splatted into a texture.
+ * Coordinates are in 1/(1 << subpixelBits) pixel units, so the
+ * anti-aliased CPU raster path can place stars between pixels, and in
+ * pixels of the raster target, which at a reduced render scale is
+ * rasterScale times the window size, for a window of width x height.
+ */
+typedef struct {
+    SDL_Point* points;
+    SDL_Point* lines;
+    int pointCount;
+    int lineCount;
+    int lodCount;       /* points[capacity - lodCount .. capacity - 1] */
+    int capacity;
+    int subpixelBits;   /* 0, or SUBPIXEL_BITS when anti-aliasing */
+    float rasterScale;  /* raster target pixels per window pixel */
+    int width, height;  /* window size the stars were projected for */
+    int shaded;         /* fill pointShades and lineShades */
+    Uint8* pointShades; /* shade key of each point, see v4iStarShade() */
+    Uint8* lineShades;  /* shade key of each segment */
+} DrawList;
+
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL_ONE  (1 << SUBPIXEL_BITS)
+
+/* How a projected star is drawn */
+enum {
+    STAR_NEAR = 0,      /* line from the old position */
+    STAR_FAR  = 1,      /* single point */
+    STAR_LOD  = 2       /* splatted into the far-field texture */
+};
+
+/* Depth beyond which stars go to the LOD texture; > 1 disables it */
+static float gLodThreshold = 2.0f;
+
+/* Sub-pixel precision the next projection should use */
+static int gSubpixelBits = 0;
+
+/* Raster target size relative to the window the next projection should use */
+static float gRasterScale = 1.0f;
+
+/* A window dimension at a render scale, never below one pixel */
+static int scaledSize(int size, float scale) {
+    return SDL_max((int)(size * scale + 0.5f), 1);
+}
+
+/* Whether the next projection should emit shade keys */
+static int gShadeStars = 0;
+
+static DrawList gDrawList;
+
+static int reserveDrawList(DrawList* dl, int count) {
+    if (count > dl->capacity) {
+        SDL_Point* points = (SDL_Point*)countedRealloc(dl->points, count * sizeof(SDL_Point));
+        if (!points) {
+            return 0;
+        }
+        dl->points = points;
+
+        SDL_Point* lines = (SDL_Point*)countedRealloc(dl->lines, 2 * count * sizeof(SDL_Point));
+        if (!lines) {
+            return 0;
+        }
+        dl->lines = lines;
+
+        /* One block for both key arrays, see emitShadedStars() */
+        Uint8* shades = (Uint8*)countedRealloc(dl->pointShades, 2 * count);
+        if (!shades) {
+            return 0;
+        }
+        dl->pointShades = shades;
+        dl->lineShades = shades + count;
+        dl->capacity = count;
+    }
+    dl->pointCount = 0;
+    dl->lineCount = 0;
+    dl->lodCount = 0;
+    return 1;
+}
+
+/* Make dst a copy of src, LOD points included */
+static int copyDrawList(DrawList* dst, const DrawList* src) {
+    if (!reserveDrawList(dst, src->capacity)) {
+        return 0;
+    }
+    memcpy(dst->points, src->points, src->pointCount * sizeof(SDL_Point));
+    memcpy(&dst->points[dst->capacity - src->lodCount], &src->points[src->capacity - src->lodCount],
+           src->lodCount * sizeof(SDL_Point));
+    memcpy(dst->lines, src->lines, 2 * src->lineCount * sizeof(SDL_Point));
+    memcpy(dst->pointShades, src->pointShades, src->pointCount);
+    memcpy(dst->lineShades, src->lineShades, src->lineCount);
+    dst->pointCount = src->pointCount;
+    dst->lineCount = src->lineCount;
+    dst->lodCount = src->lodCount;
+    dst->subpixelBits = src->subpixelBits;
+    dst->rasterScale = src->rasterScale;
+    dst->width = src->width;
+    dst->height = src->height;
+    dst->shaded = src->shaded;
+    return 1;
+}
+
+static void moveDrawPoints(SDL_Point* pts, int n, float k, float dx, float dy) {
+    for (int i = 0; i < n; i++) {
+        pts[i].x = (int)((float)pts[i].x * k + dx);
+        pts[i].y = (int)((float)pts[i].y * k + dy);
+    }
+}
+
+/*
+ * Bring a list projected under other settings up to the current ones.
+ * The simulation thread projects a frame while the settings it started
+ * with may change (anti-aliasing, render scale, window size), so the
+ * frame the renderer takes is rescaled and recentred before it is
+ * drawn.  Stars move by at most the rounding of their old coordinates.
+ */
+static void matchDrawList(DrawList* dl) {
+    if (dl->subpixelBits == gSubpixelBits && dl->rasterScale == gRasterScale &&
+        dl->width == gWidth && dl->height == gHeight) {
+        return;
+    }
+    float from = dl->rasterScale * (float)(1 << dl->subpixelBits);
+    float to = gRasterScale * (float)(1 << gSubpixelBits);
+    float dx = (float)(gWidth - dl->width) * 0.5f * to;
+    float dy = (float)(gHeight - dl->height) * 0.5f * to;
+
+    moveDrawPoints(dl->points, dl->pointCount, to / from, dx, dy);
+    moveDrawPoints(&dl->points[dl->capacity - dl->lodCount], dl->lodCount, to / from, dx, dy);
+    moveDrawPoints(dl->lines, 2 * dl->lineCount, to / from, dx, dy);
+    dl->subpixelBits = gSubpixelBits;
+    dl->rasterScale = gRasterScale;
+    dl->width = gWidth;
+    dl->height = gHeight;
+}
+
+static void freeDrawList(DrawList* dl) {
+    free(dl->points);
+    free(dl->lines);
+    free(dl->pointShades);  /* lineShades shares its block */
+    memset(dl, 0, sizeof(*dl));
+}
+
+/*
+ * Append one projected star.  The point, LOD and segment slots are all
+ * written and only the matching count advances, so there is no branch
+ * on the star class.  The point and LOD slots can only meet at the
+ * first free entry, where both writes agree.
+ */
+static inline void emitStar(DrawList* dl, int cls, int x, int y, int oldX, int oldY) {
+    SDL_Point* pt = &dl->points[dl->pointCount];
+    SDL_Point* lod = &dl->points[dl->capacity - 1 - dl->lodCount];
+    SDL_Point* ln = &dl->lines[2 * dl->lineCount];
+
+    pt->x = x;
+    pt->y = y;
+    lod->x = x;
+    lod->y = y;
+    ln[0].x = oldX;
+    ln[0].y = oldY;
+    ln[1].x = x;
+    ln[1].y = y;
+
+    dl->pointCount += cls == STAR_FAR;
+    dl->lodCount   += cls == STAR_LOD;
+    dl->lineCount  += cls == STAR_NEAR;
+}
+
+/* Exclusive prefix sum of the 4 lanes, by adding lane-shifted copies */
+static inline v4i v4iPrefix(v4i a) {
+#if defined(__SSE2__)
+    __m128i e = _mm_slli_si128((__m128i)a, 4);
+    e = _mm_add_epi32(e, _mm_slli_si128(e, 4));
+    return (v4i)_mm_add_epi32(e, _mm_slli_si128(e, 8));
+#elif defined(__ARM_NEON)
+    int32x4_t zero = vdupq_n_s32(0);
+    int32x4_t e = vextq_s32(zero, (int32x4_t)a, 3);
+    e = vaddq_s32(e, vextq_s32(zero, e, 3));
+    return (v4i)vaddq_s32(e, vextq_s32(zero, e, 2));
+#else
+    return (v4i){ 0, a[0], a[0] + a[1], a[0] + a[1] + a[2] };
+#endif
+}
+
+/*
+ * Same for the first 'lanes' of 4 stars, also recording each star's
+ * shade key in the list it joins, and only there.  The slots the keys
+ * land in are worked out for all 4 lanes at once, as offsets into the
+ * block both key arrays share; a LOD star's key goes to the uncounted
+ * point slot, like its position does.
+ */
+static inline void emitShadedStars(DrawList* dl, int lanes, v4i cls, v4i sx, v4i sy,
+                                   v4i ox, v4i oy, v4i shade) {
+    v4i near = cls == STAR_NEAR;
+    v4i far = cls == STAR_FAR;
+    v4i lineAt = (int)(dl->lineShades - dl->pointShades) + dl->lineCount - v4iPrefix(near);
+    v4i pointAt = dl->pointCount - v4iPrefix(far);
+    v4i at = pointAt + ((lineAt - pointAt) & near);
+
+    for (int k = 0; k < lanes; k++) {
+        dl->pointShades[at[k]] = (Uint8)shade[k];
+        emitStar(dl, cls[k], sx[k], sy[k], ox[k], oy[k]);
+    }
+}
+
+/*
+ * Shade keys for 4 stars: the low bits hold the depth quantized to
+ * SHADE_DEPTH_LEVELS steps, the high bits a temperature class hashed
+ * from the star's spawn position, which stays fixed for its lifetime.
+ * render() turns keys into colours through a small lookup table.
+ */
+#define SHADE_DEPTH_BITS   4
+#define SHADE_DEPTH_LEVELS (1 << SHADE_DEPTH_BITS)
+#define SHADE_TINT_BITS    3
+#define SHADE_TINTS        (1 << SHADE_TINT_BITS)
+#define SHADE_KEYS         (SHADE_DEPTH_LEVELS * SHADE_TINTS)
+
+static inline v4i v4iStarShade(v4f x, v4f y, v4f z) {
+    /* z is always in (0..1], so the depth needs no clamp */
+    v4i depth = v4iFromFloat(z * (SHADE_DEPTH_LEVELS - 1) + 0.5f);
+
+    v4u h = ((v4u)x ^ ((v4u)y >> 7)) * 0x9E3779B1u;
+    v4i tint = (v4i)(h >> (32 - SHADE_TINT_BITS));
+
+    return (tint << SHADE_DEPTH_BITS) | depth;
+}
+
+/* Star classes for 4 depths: comparisons yield -1, so negate the sum */
+static inline v4i v4iStarClass(v4f z) {
+    return -((z >= gNearThreshold) + (z >= gLodThreshold));
+}
+
+/*
+ * Fraction of a frame each update moves the stars.  Motion blur runs
+ * several shorter updates per frame; packed stars also need it to
+ * re-derive where a star was one update ago.
+ */
+static float gFrameStep = 1.0f;
+
+/* Updates run so far; seeds the packed format's rounding dither */
+static Uint32 gUpdateCount = 0;
+
+/*
+ * The old projected position of a full star is written back by
+ * projectFullStars() each frame, so the update itself is just the move.
+ */
+static void updateFullStars(Star* s, int n) {
+    const float step = gFrameStep;
+
+    for (int i = 0; i < n; i++) {
+        /* 1) Move star forward (decrease z). */
+        s[i].z -= s[i].speed * step;
+
+        /* 2) If star is too close, reinit it far away. */
+        if (s[i].z < MIN_Z) {
+            initStar(&s[i]);
+        }
+    }
+}
+
+/*
+ * Project 4 full stars with one reciprocal each, emit the first
+ * 'lanes' of them, and keep the new position as next frame's old one.
+ */
+static inline void projectFullBlock(Star* p, int lanes, DrawList* dl) {
+    const float cx = gWidth  / 2.0f;
+    const float cy = gHeight / 2.0f;
+
+    v4f z = STAR_LANES(p, z);
+    v4f factor = PERSPECTIVE_SCALE * v4fRcp(z, gRcpPrecision);
+    v4f fx = v4fClamp(cx + STAR_LANES(p, x) * factor, -SCREEN_GUARD, gWidth + SCREEN_GUARD);
+    v4f fy = v4fClamp(cy + STAR_LANES(p, y) * factor, -SCREEN_GUARD, gHeight + SCREEN_GUARD);
+    const float scale = dl->rasterScale * (float)(1 << dl->subpixelBits);
+    v4i sx = v4iFromFloat(fx * scale);
+    v4i sy = v4iFromFloat(fy * scale);
+    v4i ox = v4iFromFloat(STAR_LANES(p, oldX) * scale);
+    v4i oy = v4iFromFloat(STAR_LANES(p, oldY) * scale);
+    v4i cls = v4iStarClass(z);
+
+    if (dl->shaded) {
+        v4i shade = v4iStarShade(STAR_LANES(p, x), STAR_LANES(p, y), z);
+        emitShadedStars(dl, lanes, cls, sx, sy, ox, oy, shade);
+    } else {
+        for (int k = 0; k < lanes; k++) {
+            emitStar(dl, cls[k], sx[k], sy[k], ox[k], oy[k]);
+        }
+    }
+    for (int k = 0; k < lanes; k++) {
+        p[k].oldX = fx[k];
+        p[k].oldY = fy[k];
+    }
+}
+
+static void projectFullStars(Star* s, int n, DrawList* dl) {
+    /* Work on a local copy so the counts stay in registers */
+    DrawList out = *dl;
+
+    int i = 0;
+    for (; i + V4_LANES <= n; i += V4_LANES) {
+        projectFullBlock(&s[i], V4_LANES, &out);
+    }
+
+    /* Pad the tail with harmless stars at z = 1 */
+    if (i < n) {
+        Star tail[V4_LANES] = {{ 0, 0, 1, 0, 0, 0 }, { 0, 0, 1, 0, 0, 0 },
+                               { 0, 0, 1, 0, 0, 0 }, { 0, 0, 1, 0, 0, 0 }};
+        memcpy(tail, &s[i], (n - i) * sizeof(Star));
+        projectFullBlock(tail, n - i, &out);
+        memcpy(&s[i], tail, (n - i) * sizeof(Star));
+    }
+
+    *dl = out;
+}
+
+/*
+ * Move 4 packed stars forward by step LSBs of z per unit of speed,
+ * decoding and re-encoding z as vectors.
+ */
+static inline void updatePackedBlock(PackedStar* p, float step, Uint32 seed) {
+    v4u xy, zs;
+    v4uLoadPacked(p, &xy, &zs);
+    v4f z = v4fFromInt((v4i)(zs & 0xFFFFu)) - v4fFromInt((v4i)(zs >> 16)) * step;
+
+    /*
+     * Round with a dither, so on average every star keeps its full
+     * speed even when a step is under one LSB (slow stars, motion blur
+     * sub-frames) instead of rounding to a standstill.  The dither is
+     * the fraction of (xy + update count) * golden ratio: per star a
+     * Weyl sequence, which covers [0..1) evenly over any run of
+     * updates, and offset between stars by their position.
+     */
+    v4u h = (xy + seed) * 0x9E3779B9u;
+    v4f dither = v4fFromInt((v4i)(h >> 8)) * (1.0f / 16777216.0f);
+
+    v4i zq = v4iFromFloat(z + dither);
+    v4i respawn = z < MIN_Z * PACKED_Z_SCALE;
+    v4uStorePacked(p, xy, (zs & 0xFFFF0000u) | ((v4u)zq & 0xFFFFu));
+
+    if (respawn[0] | respawn[1] | respawn[2] | respawn[3]) {
+        for (int k = 0; k < V4_LANES; k++) {
+            if (respawn[k]) {
+                initPackedStar(&p[k]);
+            }
+        }
+    }
+}
+
+static void updatePackedStars(PackedStar* s, int n) {
+    /* Step in units of z's LSB, so a star at rest stays exactly put */
+    const float step = gFrameStep * (PACKED_Z_SCALE / PACKED_SPEED_SCALE);
+    const Uint32 seed = gUpdateCount;
+
+    int i = 0;
+    for (; i + V4_LANES <= n; i += V4_LANES) {
+        updatePackedBlock(&s[i], step, seed);
+    }
+
+    /* Pad the tail with stars at z = 1 that never respawn */
+    if (i < n) {
+        PackedStar tail[V4_LANES] = {{ 0, 0, 65535, 0 }, { 0, 0, 65535, 0 },
+                                     { 0, 0, 65535, 0 }, { 0, 0, 65535, 0 }};
+        memcpy(tail, &s[i], (n - i) * sizeof(PackedStar));
+        updatePackedBlock(tail, step, seed);
+        memcpy(&s[i], tail, (n - i) * sizeof(PackedStar));
+    }
+}
+
+/* Decode and project 4 packed stars, emitting the first 'lanes' */
+static inline void projectPackedBlock(const PackedStar* p, int lanes, DrawList* dl) {
+    const float cx = gWidth  / 2.0f;
+    const float cy = gHeight / 2.0f;
+
+    v4u xy, zs;
+    v4uLoadPacked(p, &xy, &zs);
+    v4f x = v4fFromInt((v4i)(xy << 16) >> 16) * (1.0f / PACKED_XY_SCALE);
+    v4f y = v4fFromInt((v4i)xy >> 16) * (1.0f / PACKED_XY_SCALE);
+    v4f z = v4fFromInt((v4i)(zs & 0xFFFFu)) * (1.0f / PACKED_Z_SCALE);
+    v4f zOld = z + v4fFromInt((v4i)(zs >> 16)) * (gFrameStep / PACKED_SPEED_SCALE);
+
+    /* One reciprocal of z * zOld gives both 1/z and 1/zOld */
+    v4f r = PERSPECTIVE_SCALE * v4fRcp(z * zOld, gRcpPrecision);
+    v4f factor = zOld * r;
+    v4f factorOld = z * r;
+
+    /*
+     * No guard band needed: the update respawns a packed star before
+     * its z drops below MIN_Z, so both positions stay within
+     * PERSPECTIVE_SCALE / MIN_Z pixels of the center.
+     */
+    const float scale = dl->rasterScale * (float)(1 << dl->subpixelBits);
+    v4i sx = v4iFromFloat((cx + x * factor) * scale);
+    v4i sy = v4iFromFloat((cy + y * factor) * scale);
+    v4i ox = v4iFromFloat((cx + x * factorOld) * scale);
+    v4i oy = v4iFromFloat((cy + y * factorOld) * scale);
+    v4i cls = v4iStarClass(z);
+
+    if (dl->shaded) {
+        v4i shade = v4iStarShade(x, y, z);
+        emitShadedStars(dl, lanes, cls, sx, sy, ox, oy, shade);
+    } else {
+        for (int k = 0; k < lanes; k++) {
+            emitStar(dl, cls[k], sx[k], sy[k], ox[k], oy[k]);
+        }
+    }
+}
+
+static void projectPackedStars(const PackedStar* s, int n, DrawList* dl) {
+    DrawList out = *dl;
+
+    int i = 0;
+    for (; i + V4_LANES <= n; i += V4_LANES) {
+        projectPackedBlock(&s[i], V4_LANES, &out);
+    }
+
+    if (i < n) {
+        PackedStar tail[V4_LANES] = {{ 0, 0, 65535, 0 }, { 0, 0, 65535, 0 },
+                                     { 0, 0, 65535, 0 }, { 0, 0, 65535, 0 }};
+        memcpy(tail, &s[i], (n - i) * sizeof(PackedStar));
+        projectPackedBlock(tail, n - i, &out);
+    }
+
+    *dl = out;
+}
+
+/*
+ * Kernels for the SoA and AoSoA layouts, which both come down to runs
+ * of unit-stride lanes.  The loops always cover whole vectors: SoA
+ * arrays are padded to 4 lanes and AoSoA blocks are always full, so
+ * the padding lanes hold live stars that just never get drawn.
+ */
+static inline void updateLanes(const StarLanes* l, int n) {
+    const float step = gFrameStep;
+
+    for (int i = 0; i < n; i += V4_LANES) {
+        v4f z = v4fLoad(&l->z[i]) - v4fLoad(&l->speed[i]) * step;
+        v4i respawn = z < MIN_Z;
+        v4fStore(&l->z[i], z);
+
+        if (respawn[0] | respawn[1] | respawn[2] | respawn[3]) {
+            for (int k = 0; k < V4_LANES; k++) {
+                if (respawn[k]) {
+                    Star spare;
+                    setLaneStar(l, i + k, nextRespawn(&spare));
+                }
+            }
+        }
+    }
+}
+
+/* Project the first n lanes, writing back next frame's old position */
+static inline void projectLanes(const StarLanes* l, int n, DrawList* out) {
+    const float cx = gWidth  / 2.0f;
+    const float cy = gHeight / 2.0f;
+    const float scale = out->rasterScale * (float)(1 << out->subpixelBits);
+
+    for (int i = 0; i < n; i += V4_LANES) {
+        v4f x = v4fLoad(&l->x[i]);
+        v4f y = v4fLoad(&l->y[i]);
+        v4f z = v4fLoad(&l->z[i]);
+        v4f factor = PERSPECTIVE_SCALE * v4fRcp(z, gRcpPrecision);
+        v4f fx = v4fClamp(cx + x * factor, -SCREEN_GUARD, gWidth + SCREEN_GUARD);
+        v4f fy = v4fClamp(cy + y * factor, -SCREEN_GUARD, gHeight + SCREEN_GUARD);
+        v4i sx = v4iFromFloat(fx * scale);
+        v4i sy = v4iFromFloat(fy * scale);
+        v4i ox = v4iFromFloat(v4fLoad(&l->oldX[i]) * scale);
+        v4i oy = v4iFromFloat(v4fLoad(&l->oldY[i]) * scale);
+        v4i cls = v4iStarClass(z);
+        v4fStore(&l->oldX[i], fx);
+        v4fStore(&l->oldY[i], fy);
+
+        int lanes = SDL_min(V4_LANES, n - i);
+        if (out->shaded) {
+            v4i shade = v4iStarShade(x, y, z);
+            emitShadedStars(out, lanes, cls, sx, sy, ox, oy, shade);
+        } else {
+            for (int k = 0; k < lanes; k++) {
+                emitStar(out, cls[k], sx[k], sy[k], ox[k], oy[k]);
+            }
+        }
+    }
+}
+
+static void projectSoaStars(const StarLanes* l, int n, DrawList* dl) {
+    DrawList out = *dl;
+    projectLanes(l, n, &out);
+    *dl = out;
+}
+
+static void updateBlockStars(StarBlock* blocks, int n) {
+    int count = (n + STAR_BLOCK - 1) / STAR_BLOCK;
+
+    for (int b = 0; b < count; b++) {
+        StarLanes l = blockLanes(&blocks[b]);
+        updateLanes(&l, STAR_BLOCK);
+    }
+}
+
+static void projectBlockStars(StarBlock* blocks, int n, DrawList* dl) {
+    DrawList out = *dl;
+    int count = (n + STAR_BLOCK - 1) / STAR_BLOCK;
+
+    for (int b = 0; b < count; b++) {
+        StarLanes l = blockLanes(&blocks[b]);
+        projectLanes(&l, SDL_min(STAR_BLOCK, n - b * STAR_BLOCK), &out);
+    }
+    *dl = out;
+}
+
+static void updateStarRuns(void* job, int first, int last) {
+    (void)job;
+    int from = first * UPDATE_GRAIN;
+    int n = SDL_min(last * UPDATE_GRAIN, starCount) - from;
+
+    switch (gStarFormat) {
+    case STAR_FORMAT_PACKED:
+        updatePackedStars(&packedStars[from], n);
+        break;
+    case STAR_FORMAT_SOA: {
+        StarLanes l = { &soaStars.x[from], &soaStars.y[from], &soaStars.z[from],
+                        &soaStars.oldX[from], &soaStars.oldY[from], &soaStars.speed[from] };
+        updateLanes(&l, n);
+        break;
+    }
+    case STAR_FORMAT_AOSOA:
+        updateBlockStars(&blockStars[from / STAR_BLOCK], n);
+        break;
+    default:
+        updateFullStars(&stars[from], n);
+        break;
+    }
+}
+
+static void updateStars() {
+    /* Top the respawn pool back up outside the hot loop */
+    refillRespawnPool();
+    gUpdateCount++;
+
+    parallelForSlices((starCount + UPDATE_GRAIN - 1) / UPDATE_GRAIN, updateStarRuns, NULL);
+}
+
+/* Project stars [from, from + n) onto the end of dl */
+static void projectStarRange(int from, int n, DrawList* dl) {
+    switch (gStarFormat) {
+    case STAR_FORMAT_PACKED:
+        projectPackedStars(&packedStars[from], n, dl);
+        break;
+    case STAR_FORMAT_SOA: {
+        StarLanes l = { &soaStars.x[from], &soaStars.y[from], &soaStars.z[from],
+                        &soaStars.oldX[from], &soaStars.oldY[from], &soaStars.speed[from] };
+        projectSoaStars(&l, n, dl);
+        break;
+    }
+    case STAR_FORMAT_AOSOA:
+        projectBlockStars(&blockStars[from / STAR_BLOCK], n, dl);
+        break;
+    default:
+        projectFullStars(&stars[from], n, dl);
+        break;
+    }
+}
+
+/*
+ * Parallel projection.  Each run of PROJECT_GRAIN stars is projected
+ * on whichever thread claims it into its own slice of a staging list,
+ * laid out as if the run were the whole list: points from the front,
+ * LOD points from the back, segments and shade keys alongside.  A
+ * prefix sum over the run counts then gives every run its place in
+ * the final list, and the runs copy themselves there in parallel.  The
+ * result is in star order, the same as a serial projection.
+ */
+#define PROJECT_GRAIN 16384
+#if PROJECT_GRAIN % STAR_BLOCK != 0 || PROJECT_GRAIN % V4_LANES != 0
+#error "PROJECT_GRAIN must be a multiple of STAR_BLOCK and V4_LANES"
+#endif
+
+typedef struct {
+    int points, lines, lods;           /* what the run emitted */
+    int pointAt, lineAt, lodAt;        /* where it goes in the final list */
+} ProjectRun;
+
+static DrawList    stagingList;
+static ProjectRun* projectRuns = NULL;
+static int         projectRunCapacity = 0;
+
+static void freeStaging(void) {
+    freeDrawList(&stagingList);
+    free(projectRuns);
+    projectRuns = NULL;
+    projectRunCapacity = 0;
+}
+
+static int reserveStaging(int runs) {
+    if (runs > projectRunCapacity) {
+        ProjectRun* r = (ProjectRun*)countedRealloc(projectRuns, runs * sizeof(ProjectRun));
+        if (!r) {
+            return 0;
+        }
+        projectRuns = r;
+        projectRunCapacity = runs;
+    }
+    return reserveDrawList(&stagingList, starCount);
+}
+
+/* The slice of the staging list that run r fills, with dl's settings */
+static DrawList stagingRun(const DrawList* dl, int r) {
+    int from = r * PROJECT_GRAIN;
+    DrawList run = *dl;
+    run.points = stagingList.points + from;
+    run.lines = stagingList.lines + 2 * from;
+    run.pointShades = stagingList.pointShades + from;
+    run.lineShades = stagingList.lineShades + from;
+    run.capacity = SDL_min(PROJECT_GRAIN, starCount - from);
+    run.pointCount = 0;
+    run.lineCount = 0;
+    run.lodCount = 0;
+    return run;
+}
+
+static void projectStarRuns(void* job, int first, int last) {
+    const DrawList* dl = (const DrawList*)job;
+    for (int r = first; r < last; r++) {
+        DrawList run = stagingRun(dl, r);
+        projectStarRange(r * PROJECT_GRAIN, run.capacity, &run);
+        projectRuns[r].points = run.pointCount;
+        projectRuns[r].lines = run.lineCount;
+        projectRuns[r].lods = run.lodCount;
+    }
+}
+
+static void gatherStarRuns(void* job, int first, int last) {
+    DrawList* dl = (DrawList*)job;
+    for (int r = first; r < last; r++) {
+        const ProjectRun* pr = &projectRuns[r];
+        DrawList run = stagingRun(dl, r);
+        int lodEnd = dl->capacity - pr->lodAt;
+
+        memcpy(&dl->points[pr->pointAt], run.points, pr->points * sizeof(SDL_Point));
+        memcpy(&dl->points[lodEnd - pr->lods], &run.points[run.capacity - pr->lods],
+               pr->lods * sizeof(SDL_Point));
+        memcpy(&dl->lines[2 * pr->lineAt], run.lines, 2 * pr->lines * sizeof(SDL_Point));
+        if (dl->shaded) {
+            memcpy(&dl->pointShades[pr->pointAt], run.pointShades, pr->points);
+            memcpy(&dl->lineShades[pr->lineAt], run.lineShades, pr->lines);
+        }
+    }
+}
+
+/* Project every star into the draw list for this frame */
+static void projectStars(DrawList* dl) {
+    if (!reserveDrawList(dl, starCount)) {
+        return;
+    }
+    dl->subpixelBits = gSubpixelBits;
+    dl->rasterScale = gRasterScale;
+    dl->width = gWidth;
+    dl->height = gHeight;
+    dl->shaded = gShadeStars;
+
+    /* One thread, or too few stars to share, goes straight to the list */
+    int runs = (starCount + PROJECT_GRAIN - 1) / PROJECT_GRAIN;
+    if (!pool.started) {
+        startWorkers();
+    }
+    if (pool.count == 0 || runs < 2 || !reserveStaging(runs)) {
+        projectStarRange(0, starCount, dl);
+        return;
+    }
+
+    parallelForSlices(runs, projectStarRuns, dl);
+    for (int r = 0; r < runs; r++) {
+        projectRuns[r].pointAt = dl->pointCount;
+        projectRuns[r].lineAt = dl->lineCount;
+        projectRuns[r].lodAt = dl->lodCount;
+        dl->pointCount += projectRuns[r].points;
+        dl->lineCount += projectRuns[r].lines;
+        dl->lodCount += projectRuns[r].lods;
+    }
+    parallelFor(runs, gatherStarRuns, dl);
+}
+
+/*
+ * Apply fn to every run of lanes of the SoA or AoSoA layout, padding
+ * included.
+ */
+static void forEachLaneRun(void (*fn)(const StarLanes* l, int n)) {
+    if (gStarFormat == STAR_FORMAT_SOA) {
+        fn(&soaStars, SOA_PADDED(starCount));
+    } else if (gStarFormat == STAR_FORMAT_AOSOA) {
+        int count = (starCount + STAR_BLOCK - 1) / STAR_BLOCK;
+        for (int b = 0; b < count; b++) {
+            StarLanes l = blockLanes(&blockStars[b]);
+            fn(&l, STAR_BLOCK);
+        }
+    }
+}
+
+static void randomizeLaneSpeeds(const StarLanes* l, int n) {
+    float speedScale = gSpeedScale;
+    for (int i = 0; i < n; i++) {
+        l->speed[i] = (BASE_SPEED + SPEED_RANGE * randFloat()) * speedScale;
+    }
+}
+
+static void resyncLanes(const StarLanes* l, int n) {
+    for (int i = 0; i < n; i++) {
+        float factor = PERSPECTIVE_SCALE / l->z[i];
+        l->oldX[i] = (gWidth  / 2.0f) + (l->x[i] * factor);
+        l->oldY[i] = (gHeight / 2.0f) + (l->y[i] * factor);
+    }
+}
+
+static void randomizeSpeeds(void) {
+    /* Speed controlled by slider: 0=stop, 0.5=normal, 1.0=2x */
+    gSpeedScale = speedSlider * 2.0f;
+    float speedScale = gSpeedScale;
+
+    switch (gStarFormat) {
+    case STAR_FORMAT_PACKED:
+        for (int i = 0; i < starCount; i++) {
+            float speed = (BASE_SPEED + SPEED_RANGE * randFloat()) * speedScale;
+            packedStars[i].speed = (Uint16)(speed * PACKED_SPEED_SCALE + 0.5f);
+        }
+        break;
+    case STAR_FORMAT_SOA:
+    case STAR_FORMAT_AOSOA:
+        forEachLaneRun(randomizeLaneSpeeds);
+        break;
+    default:
+        for (int i = 0; i < starCount; i++) {
+            stars[i].speed = (BASE_SPEED + SPEED_RANGE * randFloat()) * speedScale;
+        }
+        break;
+    }
+
+    /* Pooled records carry the old speed */
+    flushRespawnPool();
+}
+
+/*
+ * Simulation thread (--sim-thread).  Moves and projects the stars for
+ * frame N+1 while the render thread draws and presents frame N, and
+ * hands finished draw lists over through a triple buffer: the thread
+ * fills the back slot and swaps it into the ready slot, the renderer
+ * swaps the ready slot with its front slot when it holds a new frame.
+ * Both swaps are single atomic exchanges, so neither side ever waits
+ * on the other.  The renderer starts one simulation per frame it takes,
+ * and owns the stars and their settings from taking a frame until it
+ * starts the next simulation; changes to them only happen in that gap,
+ * and the frame just taken is brought up to them (see matchDrawList).
+ */
+#define SIM_FRESH 4   /* set in sim.ready while its slot holds an untaken frame */
+
+static int gSimThread = 0;
+
+static struct {
+    SDL_Thread*  thread;
+    SDL_sem*     go;        /* posted once per frame to simulate */
+    SDL_atomic_t quit;      /* may be set mid-frame */
+    SDL_atomic_t ready;     /* slot of the newest finished frame, plus SIM_FRESH */
+    SDL_atomic_t stepUs;    /* microseconds the last frame took to simulate */
+    int          back;      /* slot being simulated; simulation thread only */
+    int          front;     /* slot being drawn; render thread only */
+    DrawList     lists[3];
+} sim;
+
+static int simulationMain(void* data) {
+    (void)data;
+    for (;;) {
+        SDL_SemWait(sim.go);
+        if (SDL_AtomicGet(&sim.quit)) {
+            break;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        updateStars();
+        projectStars(&sim.lists[sim.back]);
+        SDL_AtomicSet(&sim.stepUs, (int)((SDL_GetPerformanceCounter() - start) * 1000000
+                                         / SDL_GetPerformanceFrequency()));
+
+        /* Publish the frame and take over whichever slot was ready */
+        sim.back = SDL_AtomicSet(&sim.ready, sim.back | SIM_FRESH) & ~SIM_FRESH;
+    }
+    return 0;
+}
+
+/* Swap in the newest simulated frame; 0 if there is none yet */
+static int takeSimFrame(void) {
+    if (!(SDL_AtomicGet(&sim.ready) & SIM_FRESH)) {
+        return 0;
+    }
+    sim.front = SDL_AtomicSet(&sim.ready, sim.front) & ~SIM_FRESH;
+    return 1;
+}
+
+static void stopSimulation(void) {
+    if (sim.thread) {
+        SDL_AtomicSet(&sim.quit, 1);
+        SDL_SemPost(sim.go);
+        SDL_WaitThread(sim.thread, NULL);
+    }
+    if (sim.go) SDL_DestroySemaphore(sim.go);
+    for (int i = 0; i < 3; i++) {
+        freeDrawList(&sim.lists[i]);
+    }
+    memset(&sim, 0, sizeof(sim));
+}
+
+/* Start the thread on its first frame; the render thread runs it inline on failure */
+static int startSimulation(void) {
+    if (!pool.started) {
+        startWorkers();
+    }
+    sim.back = 0;
+    SDL_AtomicSet(&sim.ready, 1);
+    sim.front = 2;
+
+    /* Size all three slots now; one may first be filled long after start */
+    for (int i = 0; i < 3; i++) {
+        reserveDrawList(&sim.lists[i], starCount);
+    }
+
+    /*
+     * Until the first simulated frame is ready the renderer redraws its
+     * front slot, so start that off as the frame just drawn rather than
+     * an empty one that would flash the screen starless.
+     */
+    copyDrawList(&sim.lists[sim.front], &gDrawList);
+    sim.go = SDL_CreateSemaphore(1);
+    sim.thread = sim.go ? SDL_CreateThread(simulationMain, "simulation", NULL) : NULL;
+    if (!sim.thread) {
+        printf("Could not create simulation thread! SDL_Error: %s\n", SDL_GetError());
+        stopSimulation();
+        gSimThread = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Star layer.  Normally stars are drawn straight to the screen with the
+ * SDL renderer.  The CPU raster path (--raster cpu) instead writes them
+ * into a framebuffer in system memory that is uploaded once per frame.
+ * With trails on, the layer persists between frames and is faded by
+ * gTrailDecay before the new stars are drawn, which gives long smooth
+ * trails without keeping any per-star history.  On the SDL path the
+ * persistent layer is a render-target texture faded with a modulating
+ * full-screen fill; either way it is added onto the screen at the end.
+ */
+typedef enum {
+    RASTER_SDL,
+    RASTER_CPU
+} RasterPath;
+
+static RasterPath gRasterPath = RASTER_SDL;
+static int   gTrails     = 0;
+static float gTrailDecay = 0.9f;
+
+static SDL_Texture* layerTexture = NULL;
+static Uint32* cpuPixels  = NULL;   /* CPU framebuffer, ARGB8888 */
+static int     layerWidth  = 0;
+static int     layerHeight = 0;
+static RasterPath layerPath = RASTER_SDL;
+static int     layerActive = 0;     /* stars go to the layer this frame */
+
+/*
+ * HDR accumulation (--hdr).  On the CPU path stars add their energy to
+ * a float RGBA buffer, which is tone mapped into the framebuffer once
+ * per frame, so dense regions keep their structure instead of clipping
+ * to white.  The SDL path has no float targets, so it blends stars with
+ * "screen" (dst + src * (1 - dst)) instead: n overlapping stars of level
+ * k give 1 - (1 - k)^n, an exponential tone curve done by the blender.
+ */
+typedef enum {
+    TONEMAP_REINHARD,
+    TONEMAP_ACES
+} ToneMap;
+
+static int     gHdr      = 0;
+static ToneMap gToneMap  = TONEMAP_REINHARD;
+static float   gExposure = 1.5f;
+
+static float*  hdrPixels = NULL;    /* 4 floats per framebuffer pixel */
+static float   hdrSdlLevel = 1.0f;  /* SDL path star level for this frame */
+
+/*
+ * Render scale (--scale).  Below 1 the star layer is rasterized at that
+ * fraction of the window size on either path, and the renderer
+ * stretches it over the window with nearest or bilinear filtering as
+ * it is added to the screen.  The sharpen filter runs an unsharp mask
+ * over the CPU layer before a bilinear stretch; the SDL path can't
+ * touch its pixels and stretches bilinearly.  The UI is drawn after
+ * that, at full resolution.
+ */
+typedef enum {
+    UPSCALE_NEAREST,
+    UPSCALE_BILINEAR,
+    UPSCALE_SHARPEN
+} Upscale;
+
+static float   gRenderScale = 1.0f;
+static Upscale gUpscale     = UPSCALE_BILINEAR;
+
+static Uint32* sharpPixels = NULL;  /* sharpened CPU layer */
+
+/*
+ * Motion blur (--blur, CPU path).  Each displayed frame runs
+ * gMotionSteps shorter updates and draws the stars after every one,
+ * adding them into the framebuffer at subframeWeight/256 of their
+ * colour instead of overwriting it.  The weights ramp up towards the
+ * newest sub-frame, so a moving star fades in along its path and a
+ * still one adds up to its full colour.
+ */
+#define MAX_MOTION_STEPS 16
+
+static int gMotionSteps   = 1;
+static int subframeWeight = 256;
+
+/* Weight of sub-frame s of n, proportional to s + 1 and summing to ~256 */
+static int motionWeight(int s, int n) {
+    return 512 * (s + 1) / (n * (n + 1));
+}
+
+/*
+ * Settings in effect this frame: the user's, unless the quality
+ * governor (see governFrame) has traded some of them for frame time.
+ */
+typedef struct {
+    int   motionSteps;
+    int   bloom;
+    int   antialias;
+    float renderScale;
+    float nearThreshold;
+    int   starCount;
+} Quality;
+
+static Quality gQuality = { 1, 0, 0, 1.0f, NEAR_THRESHOLD, 10000 };
+
+static void freeStarLayer(void) {
+    if (layerTexture) {
+        SDL_DestroyTexture(layerTexture);
+    }
+    free(cpuPixels);
+    free(hdrPixels);
+    free(sharpPixels);
+    hdrPixels = NULL;
+    sharpPixels = NULL;
+    layerTexture = NULL;
+    cpuPixels = NULL;
+    layerWidth = 0;
+    layerHeight = 0;
+}
+
+/* (Re)create the layer for the current path and window size, cleared */
+static int resizeStarLayer(void) {
+    int w = scaledSize(gWidth, gQuality.renderScale);
+    int h = scaledSize(gHeight, gQuality.renderScale);
+    if (layerTexture && layerPath == gRasterPath && layerWidth == w && layerHeight == h) {
+        return 1;
+    }
+    freeStarLayer();
+
+    if (gRasterPath == RASTER_CPU) {
+        cpuPixels = (Uint32*)countedCalloc(w * h, sizeof(Uint32));
+        layerTexture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_STREAMING, w, h);
+    } else if (SDL_RenderTargetSupported(gRenderer)) {
+        layerTexture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888,
+                                         SDL_TEXTUREACCESS_TARGET, w, h);
+    }
+    if (!layerTexture || (gRasterPath == RASTER_CPU && !cpuPixels)) {
+        printf("Could not create star layer! SDL_Error: %s\n", SDL_GetError());
+        freeStarLayer();
+        gRasterPath = RASTER_SDL;
+        gTrails = 0;
+        gRenderScale = 1.0f;
+        gQuality.renderScale = 1.0f;
+        return 0;
+    }
+    SDL_SetTextureBlendMode(layerTexture, SDL_BLENDMODE_ADD);
+
+    if (gRasterPath == RASTER_SDL) {
+        SDL_SetRenderTarget(gRenderer, layerTexture);
+        SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
+        SDL_RenderClear(gRenderer);
+        SDL_SetRenderTarget(gRenderer, NULL);
+    }
+
+    layerPath = gRasterPath;
+    layerWidth = w;
+    layerHeight = h;
+    return 1;
+}
+
+/*
+ * Scale every channel of the framebuffer by k/256, two channels per
+ * 32-bit multiply and four pixels per vector.  Rounding down means
+ * even the dimmest pixels reach black.
+ */
+static void decayPixels(Uint32* px, int n, Uint32 k) {
+    int i = 0;
+    for (; i + V4_LANES <= n; i += V4_LANES) {
+        v4u p;
+        memcpy(&p, &px[i], sizeof(p));
+        v4u rb = (((p & 0xFF00FFu) * k) >> 8) & 0xFF00FFu;
+        v4u g  = (((p & 0x00FF00u) * k) >> 8) & 0x00FF00u;
+        p = 0xFF000000u | rb | g;
+        memcpy(&px[i], &p, sizeof(p));
+    }
+    for (; i < n; i++) {
+        Uint32 rb = (((px[i] & 0xFF00FFu) * k) >> 8) & 0xFF00FFu;
+        Uint32 g  = (((px[i] & 0x00FF00u) * k) >> 8) & 0x00FF00u;
+        px[i] = 0xFF000000u | rb | g;
+    }
+}
+
+/* Add color scaled by w (1.0 = full) to an HDR pixel */
+static inline void hdrAdd(int i, Uint32 color, float w) {
+    float* p = &hdrPixels[4 * i];   /* B, G, R, unused */
+    w *= 1.0f / 255.0f;
+    p[0] += (color & 0xFF) * w;
+    p[1] += ((color >> 8) & 0xFF) * w;
+    p[2] += ((color >> 16) & 0xFF) * w;
+}
+
+/* Add color scaled by w/256 to one pixel, saturating each channel */
+static inline void cpuAddLight(int x, int y, Uint32 color, int w) {
+    if ((unsigned)x < (unsigned)layerWidth && (unsigned)y < (unsigned)layerHeight) {
+        w = (w * subframeWeight) >> 8;
+        if (hdrPixels) {
+            hdrAdd(y * layerWidth + x, color, w * (1.0f / 256.0f));
+            return;
+        }
+        Uint32* p = &cpuPixels[y * layerWidth + x];
+        Uint32 r = SDL_min(((*p >> 16) & 0xFF) + ((((color >> 16) & 0xFF) * w) >> 8), 255u);
+        Uint32 g = SDL_min(((*p >> 8) & 0xFF) + ((((color >> 8) & 0xFF) * w) >> 8), 255u);
+        Uint32 b = SDL_min((*p & 0xFF) + (((color & 0xFF) * w) >> 8), 255u);
+        *p = 0xFF000000u | (r << 16) | (g << 8) | b;
+    }
+}
+
+static inline void cpuPlot(int x, int y, Uint32 color) {
+    if (subframeWeight < 256) {
+        cpuAddLight(x, y, color, 256);
+        return;
+    }
+    if ((unsigned)x < (unsigned)layerWidth && (unsigned)y < (unsigned)layerHeight) {
+        if (hdrPixels) {
+            hdrAdd(y * layerWidth + x, color, 1.0f);
+        } else {
+            cpuPixels[y * layerWidth + x] = color;
+        }
+    }
+}
+
+/* Scale every HDR channel by decay, for trails */
+static void decayHdr(float* px, int n, float decay) {
+    for (int i = 0; i < 4 * n; i += V4_LANES) {
+        v4fStore(&px[i], v4fLoad(&px[i]) * decay);
+    }
+}
+
+/*
+ * Tone map one HDR pixel (B, G, R, unused) to channel values, with an
+ * opaque alpha.  The curves divide through the fast reciprocal, which
+ * is far more precise than the 8-bit output needs, and ACES can go a
+ * little over 255, which v4iStorePixels() saturates.
+ */
+static inline v4i toneMapPixel(const float* hdr, float exposure, ToneMap op) {
+    v4f c = v4fLoad(hdr) * exposure;
+    if (op == TONEMAP_ACES) {
+        /* Narkowicz's fit of the ACES filmic curve */
+        c = c * (2.51f * c + 0.03f) * v4fRcp(c * (2.43f * c + 0.59f) + 0.14f, RCP_FAST);
+    } else {
+        c = c * v4fRcp(1.0f + c, RCP_FAST);
+    }
+    return v4iFromFloat(c * 255.0f + 0.5f) | (v4i){ 0, 0, 0, 255 };
+}
+
+/* Tone map the HDR buffer into the 8-bit framebuffer, 4 pixels at a time */
+static void toneMapPixels(const float* hdr, Uint32* out, int n, float exposure, ToneMap op) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        v4iStorePixels(&out[i], toneMapPixel(&hdr[4 * i], exposure, op),
+                       toneMapPixel(&hdr[4 * i + 4], exposure, op),
+                       toneMapPixel(&hdr[4 * i + 8], exposure, op),
+                       toneMapPixel(&hdr[4 * i + 12], exposure, op));
+    }
+    for (; i < n; i++) {
+        v4i q = toneMapPixel(&hdr[4 * i], exposure, op);
+        out[i] = 0xFF000000u | ((Uint32)SDL_min(q[2], 255) << 16) |
+                 ((Uint32)SDL_min(q[1], 255) << 8) | (Uint32)SDL_min(q[0], 255);
+    }
+}
+
+/* Liang-Barsky clip of a segment to the framebuffer */
+static int clipLine(float* x0, float* y0, float* x1, float* y1) {
+    const float dx = *x1 - *x0;
+    const float dy = *y1 - *y0;
+    const float p[4] = { -dx, dx, -dy, dy };
+    const float q[4] = { *x0, layerWidth - 1 - *x0, *y0, layerHeight - 1 - *y0 };
+    float t0 = 0.0f;
+    float t1 = 1.0f;
+
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0f) {
+            if (q[i] < 0.0f) {
+                return 0;
+            }
+        } else {
+            float t = q[i] / p[i];
+            if (p[i] < 0.0f) {
+                t0 = SDL_max(t0, t);
+            } else {
+                t1 = SDL_min(t1, t);
+            }
+        }
+    }
+    if (t0 > t1) {
+        return 0;
+    }
+
+    *x1 = *x0 + t1 * dx;
+    *y1 = *y0 + t1 * dy;
+    *x0 = *x0 + t0 * dx;
+    *y0 = *y0 + t0 * dy;
+    return 1;
+}
+
+/* Bresenham line, clipped to the framebuffer first */
+static void cpuDrawLine(int ax, int ay, int bx, int by, Uint32 color) {
+    float fx0 = (float)ax, fy0 = (float)ay, fx1 = (float)bx, fy1 = (float)by;
+    if (!clipLine(&fx0, &fy0, &fx1, &fy1)) {
+        return;
+    }
+
+    int x0 = (int)(fx0 + 0.5f), y0 = (int)(fy0 + 0.5f);
+    int x1 = (int)(fx1 + 0.5f), y1 = (int)(fy1 + 0.5f);
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+
+    for (;;) {
+        cpuPlot(x0, y0, color);
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+/*
+ * Anti-aliased CPU raster (--aa).  Stars keep SUBPIXEL_BITS of
+ * fraction through projection.  Points are splatted into the 2x2
+ * pixels around them with bilinear weights, with the weights worked
+ * out for 4 points at a time, and trails are drawn as Wu lines.  Both
+ * add their light to the framebuffer, so motion below a pixel per
+ * frame shows up as a smooth shift in brightness.
+ */
+static int gAntialias = 0;
+
+/* Splat points in one color, or per point from colors[shades[i]] */
+static void cpuSplatPoints(const SDL_Point* pts, const Uint8* shades, const Uint32* colors,
+                           int n, Uint32 color) {
+    const int half = SUBPIXEL_ONE / 2;   /* pixel centres sit at +0.5 */
+    const int frac = SUBPIXEL_ONE - 1;
+
+    for (int i = 0; i < n; i += V4_LANES) {
+        int lanes = SDL_min(V4_LANES, n - i);
+        v4i x = { 0, 0, 0, 0 };
+        v4i y = { 0, 0, 0, 0 };
+        for (int k = 0; k < lanes; k++) {
+            x[k] = pts[i + k].x - half;
+            y[k] = pts[i + k].y - half;
+        }
+
+        v4i fx = x & frac;
+        v4i fy = y & frac;
+        v4i gx = SUBPIXEL_ONE - fx;
+        v4i gy = SUBPIXEL_ONE - fy;
+        v4i ix = x >> SUBPIXEL_BITS;
+        v4i iy = y >> SUBPIXEL_BITS;
+        v4i w00 = (gx * gy) >> SUBPIXEL_BITS;
+        v4i w10 = (fx * gy) >> SUBPIXEL_BITS;
+        v4i w01 = (gx * fy) >> SUBPIXEL_BITS;
+        v4i w11 = (fx * fy) >> SUBPIXEL_BITS;
+
+        for (int k = 0; k < lanes; k++) {
+            Uint32 c = shades ? colors[shades[i + k]] : color;
+            cpuAddLight(ix[k],     iy[k],     c, w00[k]);
+            cpuAddLight(ix[k] + 1, iy[k],     c, w10[k]);
+            cpuAddLight(ix[k],     iy[k] + 1, c, w01[k]);
+            cpuAddLight(ix[k] + 1, iy[k] + 1, c, w11[k]);
+        }
+    }
+}
+
+/* Wu line between sub-pixel endpoints */
+static void cpuDrawLineWu(int ax, int ay, int bx, int by, Uint32 color) {
+    const float unit = 1.0f / SUBPIXEL_ONE;
+    float x0 = ax * unit - 0.5f, y0 = ay * unit - 0.5f;
+    float x1 = bx * unit - 0.5f, y1 = by * unit - 0.5f;
+    if (!clipLine(&x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    int steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+    if (steep) {
+        float t;
+        t = x0; x0 = y0; y0 = t;
+        t = x1; x1 = y1; y1 = t;
+    }
+    if (x0 > x1) {
+        float t;
+        t = x0; x0 = x1; x1 = t;
+        t = y0; y0 = y1; y1 = t;
+    }
+
+    float dx = x1 - x0;
+    float gradient = dx > 0.0f ? (y1 - y0) / dx : 0.0f;
+    int xs = (int)floorf(x0 + 0.5f);
+    int xe = (int)floorf(x1 + 0.5f);
+    float y = y0 + gradient * (xs - x0);
+
+    for (int x = xs; x <= xe; x++, y += gradient) {
+        int iy = (int)floorf(y);
+        int upper = (int)((y - iy) * 256.0f);
+        int lower = 256 - upper;
+        if (steep) {
+            cpuAddLight(iy,     x, color, lower);
+            cpuAddLight(iy + 1, x, color, upper);
+        } else {
+            cpuAddLight(x, iy,     color, lower);
+            cpuAddLight(x, iy + 1, color, upper);
+        }
+    }
+}
+
+/*
+ * Bloom (--bloom, CPU path).  Whatever of the finished frame is above
+ * BLOOM_THRESHOLD is box-filtered into a pyramid of float images from
+ * quarter size down, and each level gets a separable 5-tap binomial blur.
+ * The levels are then added back up the pyramid with bilinear
+ * upsampling, which sums ever wider blurs into one soft glow, and the
+ * top level is added onto the frame.  A glow is soft anyway, so a half
+ * size level would only add sharpness nobody sees, at four times the
+ * cost of the rest of the pyramid.  Each pass runs over rows on the
+ * worker pool, one pixel per vector.  The result goes to its own buffer
+ * so that with trails on the glow is not fed back into the next frame.
+ */
+#define BLOOM_LEVELS    3
+#define BLOOM_THRESHOLD 153    /* channel level where the glow starts */
+
+static int   gBloom         = 0;
+static float gBloomStrength = 4.0f;   /* glow gain; thin stars need a lot */
+
+typedef struct {
+    float* px;   /* 4 floats per pixel (B, G, R, unused) */
+    int    w, h;
+} BloomLevel;
+
+static BloomLevel bloomLevels[BLOOM_LEVELS];
+static float*  bloomScratch = NULL;   /* horizontal blur pass, level 0 sized */
+static Uint32* bloomPixels  = NULL;   /* frame plus glow */
+static int     bloomWidth   = 0;
+static int     bloomHeight  = 0;
+
+static void freeBloom(void) {
+    for (int i = 0; i < BLOOM_LEVELS; i++) {
+        free(bloomLevels[i].px);
+        bloomLevels[i].px = NULL;
+    }
+    free(bloomScratch);
+    free(bloomPixels);
+    bloomScratch = NULL;
+    bloomPixels = NULL;
+    bloomWidth = 0;
+    bloomHeight = 0;
+}
+
+static int resizeBloom(int width, int height) {
+    if (bloomPixels && bloomWidth == width && bloomHeight == height) {
+        return 1;
+    }
+    freeBloom();
+
+    int w = SDL_max(width / 4, 1), h = SDL_max(height / 4, 1), ok = 1;
+    for (int i = 0; i < BLOOM_LEVELS; i++) {
+        if (i > 0) {
+            w = SDL_max(w / 2, 1);
+            h = SDL_max(h / 2, 1);
+        }
+        bloomLevels[i].w = w;
+        bloomLevels[i].h = h;
+        bloomLevels[i].px = (float*)countedMalloc(4 * w * h * sizeof(float));
+        ok &= bloomLevels[i].px != NULL;
+    }
+    bloomScratch = (float*)countedMalloc(4 * bloomLevels[0].w * bloomLevels[0].h * sizeof(float));
+    bloomPixels = (Uint32*)countedMalloc(width * height * sizeof(Uint32));
+    if (!ok || !bloomScratch || !bloomPixels) {
+        freeBloom();
+        return 0;
+    }
+    bloomWidth = width;
+    bloomHeight = height;
+    return 1;
+}
+
+static inline v4i v4iUnpackPixel(Uint32 p) {
+    return (v4i)(((v4u){ p, p, p, p } >> (v4u){ 0, 8, 16, 24 }) & 0xFFu);
+}
+
+/* How far each channel is over the threshold, or 0 */
+static inline v4i bloomBright(v4i c) {
+    c -= BLOOM_THRESHOLD;
+    return c & (c > 0);
+}
+
+static inline v8s bloomBright8(v8s c) {
+    c -= BLOOM_THRESHOLD;
+    return c & (c > 0);
+}
+
+/*
+ * Bilinear taps for scaling up by 1 << shift: the nearest source texel
+ * and its neighbour on x's side, and the neighbour's weight.
+ */
+static inline float upsampleTaps(int x, int shift, int n, int* a, int* b) {
+    float f = ((float)(x & ((1 << shift) - 1)) + 0.5f) / (float)(1 << shift) - 0.5f;
+    *a = SDL_min(x >> shift, n - 1);
+    *b = SDL_clamp(*a + (f > 0.0f ? 1 : -1), 0, n - 1);
+    return fabsf(f);
+}
+
+typedef struct {
+    const Uint32*     frame;   /* source frame, also the composite base */
+    Uint32*           out;
+    const BloomLevel* from;
+    const BloomLevel* to;
+    v4f               scale;   /* glow to 8-bit channel scale, 0 for alpha */
+} BloomJob;
+
+/*
+ * Level 0 rows: the 4x4 average of what each frame pixel has over the
+ * threshold, summed in 16-bit lanes (16 * 102 fits) so there is one
+ * conversion per texel.
+ */
+static void bloomBrightRows(void* data, int first, int last) {
+    const BloomJob* job = (const BloomJob*)data;
+    const BloomLevel* to = job->to;
+    const float k = 1.0f / (16.0f * 255.0f);
+
+    for (int y = first; y < last; y++) {
+        const Uint32* r[4];
+        for (int i = 0; i < 4; i++) {
+            r[i] = &job->frame[SDL_min(4 * y + i, bloomHeight - 1) * bloomWidth];
+        }
+        float* d = &to->px[4 * y * to->w];
+        int x = 0;
+        for (; 4 * x + 4 <= bloomWidth && x < to->w; x++) {
+            v8s c = { 0 };
+            for (int i = 0; i < 4; i++) {
+                v8s lo, hi;
+                v8sLoadPixels(&r[i][4 * x], &lo, &hi);
+                c += bloomBright8(lo) + bloomBright8(hi);
+            }
+            v4fStore(&d[4 * x], v4fFromInt(v4iAddPixels(c)) * k);
+        }
+        for (; x < to->w; x++) {
+            v4i c = { 0 };
+            for (int i = 0; i < 16; i++) {
+                c += bloomBright(v4iUnpackPixel(r[i >> 2][SDL_min(4 * x + (i & 3), bloomWidth - 1)]));
+            }
+            v4fStore(&d[4 * x], v4fFromInt(c) * k);
+        }
+    }
+}
+
+/* Next level rows: 2x2 average of the (blurred) level above */
+static void bloomDownsampleRows(void* data, int first, int last) {
+    const BloomJob* job = (const BloomJob*)data;
+    const BloomLevel* from = job->from;
+    const BloomLevel* to = job->to;
+
+    for (int y = first; y < last; y++) {
+        const float* r0 = &from->px[4 * SDL_min(2 * y, from->h - 1) * from->w];
+        const float* r1 = &from->px[4 * SDL_min(2 * y + 1, from->h - 1) * from->w];
+        float* d = &to->px[4 * y * to->w];
+        for (int x = 0; x < to->w; x++) {
+            int x0 = 4 * 2 * x, x1 = 4 * SDL_min(2 * x + 1, from->w - 1);
+            v4f c = v4fLoad(&r0[x0]) + v4fLoad(&r0[x1]) + v4fLoad(&r1[x0]) + v4fLoad(&r1[x1]);
+            v4fStore(&d[4 * x], c * 0.25f);
+        }
+    }
+}
+
+/* 1 4 6 4 1 binomial of 5 texels, 1/16 normalised */
+static inline v4f bloomBinomial(v4f m2, v4f m1, v4f c, v4f p1, v4f p2) {
+    return (m2 + p2 + (m1 + p1) * 4.0f + c * 6.0f) * (1.0f / 16.0f);
+}
+
+/* The blur at texel x of a row, clamping at the edges */
+static inline v4f bloomBlurEdge(const float* s, int x, int w) {
+    return bloomBinomial(v4fLoad(&s[4 * SDL_max(x - 2, 0)]), v4fLoad(&s[4 * SDL_max(x - 1, 0)]),
+                         v4fLoad(&s[4 * x]),
+                         v4fLoad(&s[4 * SDL_min(x + 1, w - 1)]), v4fLoad(&s[4 * SDL_min(x + 2, w - 1)]));
+}
+
+/* The blur along rows, level -> scratch */
+static void bloomBlurRowsH(void* data, int first, int last) {
+    const BloomLevel* l = ((const BloomJob*)data)->to;
+
+    for (int y = first; y < last; y++) {
+        const float* s = &l->px[4 * y * l->w];
+        float* d = &bloomScratch[4 * y * l->w];
+        int x = 0;
+        for (; x < SDL_min(2, l->w); x++) {
+            v4fStore(&d[4 * x], bloomBlurEdge(s, x, l->w));
+        }
+        for (; x < l->w - 2; x++) {
+            const float* t = &s[4 * x];
+            v4fStore(&d[4 * x], bloomBinomial(v4fLoad(t - 8), v4fLoad(t - 4), v4fLoad(t),
+                                              v4fLoad(t + 4), v4fLoad(t + 8)));
+        }
+        for (; x < l->w; x++) {
+            v4fStore(&d[4 * x], bloomBlurEdge(s, x, l->w));
+        }
+    }
+}
+
+/* The same down columns, scratch -> level */
+static void bloomBlurRowsV(void* data, int first, int last) {
+    const BloomLevel* l = ((const BloomJob*)data)->to;
+    const int stride = 4 * l->w;
+
+    for (int y = first; y < last; y++) {
+        const float* m2 = &bloomScratch[SDL_max(y - 2, 0) * stride];
+        const float* m1 = &bloomScratch[SDL_max(y - 1, 0) * stride];
+        const float* c0 = &bloomScratch[y * stride];
+        const float* p1 = &bloomScratch[SDL_min(y + 1, l->h - 1) * stride];
+        const float* p2 = &bloomScratch[SDL_min(y + 2, l->h - 1) * stride];
+        float* d = &l->px[y * stride];
+        for (int i = 0; i < stride; i += V4_LANES) {
+            v4fStore(&d[i], bloomBinomial(v4fLoad(&m2[i]), v4fLoad(&m1[i]), v4fLoad(&c0[i]),
+                                          v4fLoad(&p1[i]), v4fLoad(&p2[i])));
+        }
+    }
+}
+
+/* Level texel j lerped between two of its rows, wb of the way to rb */
+static inline v4f bloomLerpRows(const float* ra, const float* rb, float wb, int j) {
+    return v4fLoad(&ra[4 * j]) * (1.0f - wb) + v4fLoad(&rb[4 * j]) * wb;
+}
+
+/* Bilinear sample at x of a level row pair, at 1 << shift the level's size */
+static inline v4f bloomUpsample(const float* ra, const float* rb, float wb, int x, int shift, int w) {
+    int a, b;
+    float wx = upsampleTaps(x, shift, w, &a, &b);
+    return bloomLerpRows(ra, rb, wb, a) * (1.0f - wx) + bloomLerpRows(ra, rb, wb, b) * wx;
+}
+
+/*
+ * Add the level below, upsampled, into a level.  Each pair of texels
+ * shares a source texel, so the vertical lerp is done once per source
+ * texel and slid along the row.
+ */
+static void bloomUpsampleRows(void* data, int first, int last) {
+    const BloomJob* job = (const BloomJob*)data;
+    const BloomLevel* from = job->from;
+    const BloomLevel* to = job->to;
+
+    for (int y = first; y < last; y++) {
+        int a, b;
+        float wb = upsampleTaps(y, 1, from->h, &a, &b);
+        const float* ra = &from->px[4 * a * from->w];
+        const float* rb = &from->px[4 * b * from->w];
+        float* d = &to->px[4 * y * to->w];
+
+        v4f c0 = bloomLerpRows(ra, rb, wb, 0);
+        v4f prev = c0;
+        int x = 0;
+        for (int j = 0; x + 2 <= to->w; j++, x += 2) {
+            v4f c1 = bloomLerpRows(ra, rb, wb, SDL_min(j + 1, from->w - 1));
+            v4fStore(&d[4 * x], v4fLoad(&d[4 * x]) + c0 * 0.75f + prev * 0.25f);
+            v4fStore(&d[4 * x + 4], v4fLoad(&d[4 * x + 4]) + c0 * 0.75f + c1 * 0.25f);
+            prev = c0;
+            c0 = c1;
+        }
+        for (; x < to->w; x++) {
+            v4fStore(&d[4 * x], v4fLoad(&d[4 * x]) + bloomUpsample(ra, rb, wb, x, 1, from->w));
+        }
+    }
+}
+
+/*
+ * Frame rows plus the glow upsampled 4x, 4 pixels (one level texel) at
+ * a time, lerps slid as above.  The lerps come scaled, rounded and
+ * capped at 255 (the pixel saturates there anyway), so the horizontal
+ * weights, in eighths, run in 16-bit lanes next to the frame's pixels.
+ */
+static void bloomCompositeRows(void* data, int first, int last) {
+    const BloomJob* job = (const BloomJob*)data;
+    const BloomLevel* from = job->from;
+    const v4f scale = job->scale;
+    const v4f half = { 0.5f, 0.5f, 0.5f, 0.0f };
+    const v8s opaque = { 0, 0, 0, 255, 0, 0, 0, 255 };   /* cleared pixels have alpha 0 */
+    const v8s near01 = { 5, 5, 5, 5, 7, 7, 7, 7 }, far01 = { 3, 3, 3, 3, 1, 1, 1, 1 };
+    const v8s near23 = { 7, 7, 7, 7, 5, 5, 5, 5 }, far23 = { 1, 1, 1, 1, 3, 3, 3, 3 };
+    const int last0 = from->w - 1;
+
+    for (int y = first; y < last; y++) {
+        int a, b;
+        float wb = upsampleTaps(y, 2, from->h, &a, &b);
+        const float* ra = &from->px[4 * a * from->w];
+        const float* rb = &from->px[4 * b * from->w];
+        const Uint32* s = &job->frame[y * bloomWidth];
+        Uint32* d = &job->out[y * bloomWidth];
+
+        v4i g0 = v4iFromFloat(v4fClamp(bloomLerpRows(ra, rb, wb, 0) * scale + half, 0.0f, 255.0f));
+        v8s c0 = v8sFromPixels(g0, g0);
+        v8s prev = c0;
+        int x = 0;
+        for (int j = 0; x + 4 <= bloomWidth; j++, x += 4) {
+            v4f g = bloomLerpRows(ra, rb, wb, SDL_min(j + 1, last0)) * scale + half;
+            v4i g1 = v4iFromFloat(v4fClamp(g, 0.0f, 255.0f));
+            v8s c1 = v8sFromPixels(g1, g1);
+            v8s lo, hi;
+            v8sLoadPixels(&s[x], &lo, &hi);
+            lo += (c0 * near01 + prev * far01 + 4) >> 3;
+            hi += (c0 * near23 + c1 * far23 + 4) >> 3;
+            v8sStorePixels(&d[x], lo | opaque, hi | opaque);
+            prev = c0;
+            c0 = c1;
+        }
+        for (; x < bloomWidth; x++) {
+            v4f g = bloomUpsample(ra, rb, wb, x, 2, from->w);
+            v4i q = v4iUnpackPixel(s[x]) + v4iFromFloat(g * scale + half);
+            d[x] = 0xFF000000u | ((Uint32)SDL_min(q[2], 255) << 16) |
+                   ((Uint32)SDL_min(q[1], 255) << 8) | (Uint32)SDL_min(q[0], 255);
+        }
+    }
+}
+
+/* The frame with glow added, or the frame itself if there's no memory for it */
+static const Uint32* applyBloom(const Uint32* frame, int width, int height) {
+    if (!resizeBloom(width, height)) {
+        printf("Could not allocate bloom buffers!\n");
+        gBloom = 0;
+        return frame;
+    }
+
+    BloomJob job = { frame, bloomPixels, NULL, &bloomLevels[0], { 0 } };
+    parallelFor(job.to->h, bloomBrightRows, &job);
+    for (int i = 0; i < BLOOM_LEVELS; i++) {
+        if (i > 0) {
+            job.from = &bloomLevels[i - 1];
+            job.to = &bloomLevels[i];
+            parallelFor(job.to->h, bloomDownsampleRows, &job);
+        }
+        parallelFor(job.to->h, bloomBlurRowsH, &job);
+        parallelFor(job.to->h, bloomBlurRowsV, &job);
+    }
+    for (int i = BLOOM_LEVELS - 1; i > 0; i--) {
+        job.from = &bloomLevels[i];
+        job.to = &bloomLevels[i - 1];
+        parallelFor(job.to->h, bloomUpsampleRows, &job);
+    }
+
+    /* Every level adds the same light; the skipped half size level's share goes on top */
+    float k = gBloomStrength * 255.0f * (BLOOM_LEVELS + 1) / BLOOM_LEVELS;
+    job.from = &bloomLevels[0];
+    job.scale = (v4f){ k, k, k, 0.0f };
+    parallelFor(height, bloomCompositeRows, &job);
+    return bloomPixels;
+}
+
+/*
+ * Sharpened upscale: an unsharp mask, 1.5c - (n + s + e + w) / 8, over
+ * the reduced-size CPU layer, which the renderer then stretches
+ * bilinearly.  Run over rows on the worker pool, 4 pixels per step in
+ * 16-bit lanes (12 * 255 fits).
+ */
+typedef struct {
+    const Uint32* src;
+    Uint32*       dst;
+    int           width, height;
+} SharpenJob;
+
+static inline Uint32 sharpenPixel(const Uint32* up, const Uint32* row, const Uint32* down,
+                                  int x, int w) {
+    v4i q = v4iUnpackPixel(row[x]) * 12 -
+            (v4iUnpackPixel(row[SDL_max(x - 1, 0)]) + v4iUnpackPixel(row[SDL_min(x + 1, w - 1)]) +
+             v4iUnpackPixel(up[x]) + v4iUnpackPixel(down[x]));
+    q >>= 3;
+    return 0xFF000000u | ((Uint32)SDL_clamp(q[2], 0, 255) << 16) |
+           ((Uint32)SDL_clamp(q[1], 0, 255) << 8) | (Uint32)SDL_clamp(q[0], 0, 255);
+}
+
+static void sharpenRows(void* data, int first, int last) {
+    const SharpenJob* job = (const SharpenJob*)data;
+    const int w = job->width;
+    const v8s rgb = { -1, -1, -1, 0, -1, -1, -1, 0 };
+    const v8s opaque = { 0, 0, 0, 255, 0, 0, 0, 255 };
+
+    for (int y = first; y < last; y++) {
+        const Uint32* row = &job->src[y * w];
+        const Uint32* up = &job->src[SDL_max(y - 1, 0) * w];
+        const Uint32* down = &job->src[SDL_min(y + 1, job->height - 1) * w];
+        Uint32* d = &job->dst[y * w];
+
+        int x = 0;
+        for (; x < SDL_min(1, w); x++) {
+            d[x] = sharpenPixel(up, row, down, x, w);
+        }
+        for (; x + 4 < w; x += 4) {
+            v8s c[2], l[2], r[2], u[2], b[2], q[2];
+            v8sLoadPixels(&row[x], &c[0], &c[1]);
+            v8sLoadPixels(&row[x - 1], &l[0], &l[1]);
+            v8sLoadPixels(&row[x + 1], &r[0], &r[1]);
+            v8sLoadPixels(&up[x], &u[0], &u[1]);
+            v8sLoadPixels(&down[x], &b[0], &b[1]);
+            for (int k = 0; k < 2; k++) {
+                q[k] = (((c[k] * 12 - (l[k] + r[k] + u[k] + b[k])) >> 3) & rgb) | opaque;
+            }
+            v8sStorePixels(&d[x], q[0], q[1]);
+        }
+        for (; x < w; x++) {
+            d[x] = sharpenPixel(up, row, down, x, w);
+        }
+    }
+}
+
+/* The sharpened layer, or the layer itself if there's no memory for it */
+static const Uint32* sharpenPixels(const Uint32* src, int width, int height) {
+    if (!sharpPixels) {
+        sharpPixels = (Uint32*)countedMalloc(width * height * sizeof(Uint32));
+        if (!sharpPixels) {
+            printf("Could not allocate the sharpen buffer!\n");
+            gUpscale = UPSCALE_BILINEAR;
+            return src;
+        }
+    }
+
+    SharpenJob job = { src, sharpPixels, width, height };
+    parallelFor(height, sharpenRows, &job);
+    return sharpPixels;
+}
+
+/*
+ * Decide where stars go this frame, before they are projected, since
+ * the anti-aliased path needs sub-pixel coordinates.
+ */
+static void prepareStarLayer(void) {
+    if (!gTrails && gQuality.renderScale >= 1.0f && gRasterPath == RASTER_SDL) {
+        /* Drop the old layer so re-enabling trails starts from black */
+        freeStarLayer();
+        layerActive = 0;
+    } else {
+        layerActive = resizeStarLayer();
+    }
+    gRasterScale = layerActive ? gQuality.renderScale : 1.0f;
+
+    gSubpixelBits = (layerActive && layerPath == RASTER_CPU && gQuality.antialias) ? SUBPIXEL_BITS : 0;
+
+    /* The HDR buffer lives and dies with the CPU layer */
+    int hdr = layerActive && layerPath == RASTER_CPU && gHdr;
+    if (hdr && !hdrPixels) {
+        hdrPixels = (float*)countedCalloc(4 * layerWidth * layerHeight, sizeof(float));
+    } else if (!hdr) {
+        free(hdrPixels);
+        hdrPixels = NULL;
+    }
+
+    if (!(layerActive && layerPath == RASTER_CPU && gQuality.bloom)) {
+        freeBloom();
+    }
+}
+
+/* Point the star drawing at the layer (if any) and fade or clear it */
+static void beginStarLayer(void) {
+    if (layerActive && layerPath == RASTER_CPU) {
+        int n = layerWidth * layerHeight;
+        if (hdrPixels) {
+            if (gTrails) {
+                decayHdr(hdrPixels, n, gTrailDecay);
+            } else {
+                memset(hdrPixels, 0, 4 * n * sizeof(float));
+            }
+        } else if (gTrails) {
+            decayPixels(cpuPixels, n, (Uint32)(gTrailDecay * 256.0f));
+        } else {
+            memset(cpuPixels, 0, n * sizeof(Uint32));
+        }
+        return;
+    }
+
+    if (layerActive && gTrails) {
+        /* dst = dst * decay */
+        Uint8 d = (Uint8)(gTrailDecay * 255.0f);
+        SDL_SetRenderTarget(gRenderer, layerTexture);
+        SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_MOD);
+        SDL_SetRenderDrawColor(gRenderer, d, d, d, 255);
+        SDL_RenderFillRect(gRenderer, NULL);
+
+        /*
+         * The GPU rounds the product to nearest, so dim pixels would
+         * settle at a grey haze instead of black.  Take one more LSB
+         * off every frame (dst = dst - 1) so they keep fading out, as
+         * the CPU path's rounding down does.
+         */
+        SDL_BlendMode lsb = SDL_ComposeCustomBlendMode(
+            SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE, SDL_BLENDOPERATION_REV_SUBTRACT,
+            SDL_BLENDFACTOR_ZERO, SDL_BLENDFACTOR_ONE, SDL_BLENDOPERATION_ADD);
+        if (SDL_SetRenderDrawBlendMode(gRenderer, lsb) == 0) {
+            SDL_SetRenderDrawColor(gRenderer, 1, 1, 1, 255);
+            SDL_RenderFillRect(gRenderer, NULL);
+        }
+    } else if (layerActive) {
+        SDL_SetRenderTarget(gRenderer, layerTexture);
+        SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
+        SDL_RenderClear(gRenderer);
+    }
+
+    if (!gHdr) {
+        SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_NONE);
+        return;
+    }
+
+    /* One star alone matches the CPU path's Reinhard level */
+    hdrSdlLevel = gExposure / (1.0f + gExposure);
+    SDL_BlendMode screen = SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE_MINUS_DST_COLOR, SDL_BLENDFACTOR_ONE, SDL_BLENDOPERATION_ADD,
+        SDL_BLENDFACTOR_ZERO, SDL_BLENDFACTOR_ONE, SDL_BLENDOPERATION_ADD);
+    if (SDL_SetRenderDrawBlendMode(gRenderer, screen) < 0) {
+        /* Plain saturating add where the renderer can't do custom blends */
+        SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_ADD);
+    }
+}
+
+/* Add the layer onto the screen */
+static void endStarLayer(void) {
+    SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_NONE);
+    if (!layerActive) {
+        return;
+    }
+
+    if (layerPath == RASTER_CPU) {
+        if (hdrPixels) {
+            toneMapPixels(hdrPixels, cpuPixels, layerWidth * layerHeight, gExposure, gToneMap);
+        }
+        const Uint32* frame = gQuality.bloom ? applyBloom(cpuPixels, layerWidth, layerHeight) : cpuPixels;
+        if (gUpscale == UPSCALE_SHARPEN && layerWidth < gWidth) {
+            frame = sharpenPixels(frame, layerWidth, layerHeight);
+        }
+        SDL_UpdateTexture(layerTexture, NULL, frame, layerWidth * sizeof(Uint32));
+    } else {
+        SDL_SetRenderTarget(gRenderer, NULL);
+    }
+
+    /* The one upscaling pass, if the layer is smaller than the window */
+    SDL_SetTextureScaleMode(layerTexture,
+        gUpscale == UPSCALE_NEAREST ? SDL_ScaleModeNearest : SDL_ScaleModeLinear);
+    SDL_RenderCopy(gRenderer, layerTexture, NULL, NULL);
+}
+
+/*
+ * Star shading.  Depth brightness and spectral tint come from two small
+ * tables that are folded into shadeColors[], indexed by the shade key
+ * the projection kernels emit for every star.  The CPU path looks each
+ * star's color up directly.  The SDL path sorts the stars by key first
+ * so each color is set once per frame, never once per star.
+ */
+static int gDepthShading = 0;
+static int gStarTint     = 0;
+
+/* Roughly the colors of O/B through M class stars */
+static const Uint8 tintColors[SHADE_TINTS][3] = {
+    { 155, 176, 255 }, { 170, 191, 255 }, { 202, 215, 255 }, { 248, 247, 255 },
+    { 255, 244, 234 }, { 255, 238, 220 }, { 255, 210, 161 }, { 255, 190, 130 }
+};
+
+static Uint32 shadeColors[SHADE_KEYS];
+static int    shadeKeyMask = 0;         /* key bits that matter this frame */
+static SDL_Point* shadeSorted = NULL;   /* points or segments sorted by key */
+static int    shadeCapacity = 0;
+static int    shadeCounts[SHADE_KEYS];
+
+static void updateShadeTable(void) {
+    static const Uint8 white[3] = { 255, 255, 255 };
+
+    for (int t = 0; t < SHADE_TINTS; t++) {
+        for (int d = 0; d < SHADE_DEPTH_LEVELS; d++) {
+            /* Full brightness up close, falling to 30% at the far plane */
+            float z = d / (float)(SHADE_DEPTH_LEVELS - 1);
+            float b = gDepthShading ? 0.3f + 0.7f * (1.0f - z) * (1.0f - z) : 1.0f;
+            const Uint8* c = gStarTint ? tintColors[t] : white;
+            Uint32 r = (Uint32)(c[0] * b + 0.5f);
+            Uint32 g = (Uint32)(c[1] * b + 0.5f);
+            Uint32 bl = (Uint32)(c[2] * b + 0.5f);
+            shadeColors[(t << SHADE_DEPTH_BITS) | d] = 0xFF000000u | (r << 16) | (g << 8) | bl;
+        }
+    }
+
+    shadeKeyMask = (gDepthShading ? SHADE_DEPTH_LEVELS - 1 : 0) |
+                   (gStarTint ? (SHADE_TINTS - 1) << SHADE_DEPTH_BITS : 0);
+}
+
+/* Counting sort of n points (stride 1) or segments (stride 2) by masked shade key */
+static int sortByShade(const SDL_Point* items, const Uint8* shades, int n, int stride) {
+    if (n * stride > shadeCapacity) {
+        /* Room for every star as a segment, so a new high never reallocates */
+        int capacity = SDL_max(n * stride, 2 * starCount);
+        SDL_Point* sorted = (SDL_Point*)countedRealloc(shadeSorted, capacity * sizeof(SDL_Point));
+        if (!sorted) {
+            return 0;
+        }
+        shadeSorted = sorted;
+        shadeCapacity = capacity;
+    }
+
+    /* Locals, so the loops don't reload them after every store */
+    const int mask = shadeKeyMask;
+    SDL_Point* sorted = shadeSorted;
+    int offsets[SHADE_KEYS];
+    memset(shadeCounts, 0, sizeof(shadeCounts));
+    for (int i = 0; i < n; i++) {
+        shadeCounts[shades[i] & mask]++;
+    }
+    offsets[0] = 0;
+    for (int k = 1; k < SHADE_KEYS; k++) {
+        offsets[k] = offsets[k - 1] + shadeCounts[k - 1];
+    }
+    if (stride == 1) {
+        for (int i = 0; i < n; i++) {
+            sorted[offsets[shades[i] & mask]++] = items[i];
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            int at = 2 * offsets[shades[i] & mask]++;
+            sorted[at] = items[2 * i];
+            sorted[at + 1] = items[2 * i + 1];
+        }
+    }
+    return 1;
+}
+
+/* Set an SDL draw color, scaled to the HDR star level when blending */
+static void setDrawColor(Uint32 color) {
+    float k = gHdr ? hdrSdlLevel : 1.0f;
+    SDL_SetRenderDrawColor(gRenderer, (Uint8)(((color >> 16) & 0xFF) * k),
+                           (Uint8)(((color >> 8) & 0xFF) * k), (Uint8)((color & 0xFF) * k), 255);
+}
+
+/*
+ * Draw points in grey level b on whichever path is active, or in their
+ * own shade colors if shades is given.  subpixelBits is that of the
+ * list the points come from.
+ */
+static void plotPoints(const SDL_Point* pts, const Uint8* shades, int n, Uint8 b, int subpixelBits) {
+    Uint32 grey = 0xFF000000u | (b * 0x010101u);
+
+    if (subpixelBits) {
+        cpuSplatPoints(pts, shades, shadeColors, n, grey);
+    } else if (layerActive && layerPath == RASTER_CPU) {
+        if (shades) {
+            for (int i = 0; i < n; i++) {
+                cpuPlot(pts[i].x, pts[i].y, shadeColors[shades[i]]);
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                cpuPlot(pts[i].x, pts[i].y, grey);
+            }
+        }
+    } else if (shades && sortByShade(pts, shades, n, 1)) {
+        int first = 0;
+        for (int k = 0; k < SHADE_KEYS; k++) {
+            if (shadeCounts[k]) {
+                setDrawColor(shadeColors[k]);
+                SDL_RenderDrawPoints(gRenderer, &shadeSorted[first], shadeCounts[k]);
+                first += shadeCounts[k];
+            }
+        }
+    } else {
+        setDrawColor(grey);
+        SDL_RenderDrawPoints(gRenderer, pts, n);
+    }
+}
+
+static void drawNearStars(const DrawList* dl, const Uint8* shades) {
+    if (dl->subpixelBits) {
+        for (int i = 0; i < dl->lineCount; i++) {
+            const SDL_Point* ln = &dl->lines[2 * i];
+            Uint32 color = shades ? shadeColors[shades[i]] : 0xFFFFFFFFu;
+            cpuDrawLineWu(ln[0].x, ln[0].y, ln[1].x, ln[1].y, color);
+        }
+        return;
+    }
+
+    if (layerActive && layerPath == RASTER_CPU) {
+        for (int i = 0; i < dl->lineCount; i++) {
+            const SDL_Point* ln = &dl->lines[2 * i];
+            Uint32 color = shades ? shadeColors[shades[i]] : 0xFFFFFFFFu;
+            cpuDrawLine(ln[0].x, ln[0].y, ln[1].x, ln[1].y, color);
+        }
+        return;
+    }
+
+    if (shades && sortByShade(dl->lines, shades, dl->lineCount, 2)) {
+        const SDL_Point* ln = shadeSorted;
+        for (int k = 0; k < SHADE_KEYS; k++) {
+            if (shadeCounts[k]) {
+                setDrawColor(shadeColors[k]);
+            }
+            for (int i = 0; i < shadeCounts[k]; i++, ln += 2) {
+                SDL_RenderDrawLine(gRenderer, ln[0].x, ln[0].y, ln[1].x, ln[1].y);
+            }
+        }
+        return;
+    }
+
+    setDrawColor(0xFFFFFFFFu);
+    for (int i = 0; i < dl->lineCount; i++) {
+        const SDL_Point* ln = &dl->lines[2 * i];
+        SDL_RenderDrawLine(gRenderer, ln[0].x, ln[0].y, ln[1].x, ln[1].y);
+    }
+}
+
+/*
+ * Far-star deduplication.  At high star counts most far stars project
+ * into the small central region and many land on the same pixel.  The
+ * point list is filtered through a per-pixel hit counter so only one
+ * point per pixel is submitted, which bounds the far-field draw cost
+ * by the screen area instead of the star count.  With density shading
+ * on, the number of stars that hit a pixel sets its brightness.
+ */
+#define DENSITY_LEVELS 4
+
+static int gDedupFarStars  = 1;
+static int gDensityShading = 0;
+
+static const Uint8 densityMinHits[DENSITY_LEVELS]    = { 1, 2, 4, 8 };
+static const Uint8 densityBrightness[DENSITY_LEVELS] = { 110, 160, 210, 255 };
+
+static Uint8* pixelHits = NULL;     /* per-pixel hit counts, saturating */
+static int    pixelHitsSize = 0;    /* gWidth * gHeight it was sized for */
+static SDL_Point* densityPoints = NULL;
+static int    densityCapacity = 0;
+static int    densityCounts[DENSITY_LEVELS];
+
+static int dedupFarStars(DrawList* dl) {
+    int size = gWidth * gHeight;
+
+    if (size != pixelHitsSize) {
+        Uint8* hits = (Uint8*)countedRealloc(pixelHits, size);
+        if (!hits) {
+            return 0;
+        }
+        memset(hits, 0, size);
+        pixelHits = hits;
+        pixelHitsSize = size;
+    }
+
+    /* Keep the first point on every on-screen pixel, count the rest */
+    SDL_Point* pts = dl->points;
+    int kept = 0;
+    for (int i = 0; i < dl->pointCount; i++) {
+        int x = pts[i].x;
+        int y = pts[i].y;
+        if ((unsigned)x >= (unsigned)gWidth || (unsigned)y >= (unsigned)gHeight) {
+            continue;
+        }
+        Uint8* hit = &pixelHits[y * gWidth + x];
+        pts[kept] = pts[i];
+        dl->pointShades[kept] = dl->pointShades[i];
+        kept += (*hit == 0);
+        *hit += (*hit != 255);
+    }
+    dl->pointCount = kept;
+    return 1;
+}
+
+/*
+ * Bucket the deduplicated points by hit count (a counting sort into
+ * densityPoints), then reset the counters they touched.
+ */
+static int bucketDensity(const DrawList* dl) {
+    if (dl->pointCount > densityCapacity) {
+        int capacity = SDL_max(dl->pointCount, dl->capacity);
+        SDL_Point* points = (SDL_Point*)countedRealloc(densityPoints, capacity * sizeof(SDL_Point));
+        if (!points) {
+            return 0;
+        }
+        densityPoints = points;
+        densityCapacity = capacity;
+    }
+
+    int offsets[DENSITY_LEVELS];
+    memset(densityCounts, 0, sizeof(densityCounts));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < dl->pointCount; i++) {
+            Uint8 hits = pixelHits[dl->points[i].y * gWidth + dl->points[i].x];
+            int level = (hits >= densityMinHits[1]) + (hits >= densityMinHits[2]) +
+                        (hits >= densityMinHits[3]);
+            if (pass == 0) {
+                densityCounts[level]++;
+            } else {
+                densityPoints[offsets[level]++] = dl->points[i];
+            }
+        }
+        offsets[0] = 0;
+        for (int l = 1; l < DENSITY_LEVELS; l++) {
+            offsets[l] = offsets[l - 1] + densityCounts[l - 1];
+        }
+    }
+    return 1;
+}
+
+static void clearPixelHits(const DrawList* dl) {
+    for (int i = 0; i < dl->pointCount; i++) {
+        pixelHits[dl->points[i].y * gWidth + dl->points[i].x] = 0;
+    }
+}
+
+static void drawFarStars(const DrawList* dl, const Uint8* shades) {
+    if (gDensityShading && bucketDensity(dl)) {
+        int first = 0;
+        for (int l = 0; l < DENSITY_LEVELS; l++) {
+            plotPoints(&densityPoints[first], NULL, densityCounts[l], densityBrightness[l], 0);
+            first += densityCounts[l];
+        }
+    } else {
+        plotPoints(dl->points, shades, dl->pointCount, 255, dl->subpixelBits);
+    }
+}
+
+/*
+ * Far-field level of detail.  Stars beyond gFarLodDepth are sub-pixel
+ * and move less than a pixel over a few frames, so instead of drawing
+ * them one by one they are counted into a grid at 1/LOD_SCALE of the
+ * window resolution, uploaded to a texture, and the whole far field is
+ * composited with one texture copy.  The grid is rebuilt from every new
+ * draw list: reusing it for longer would draw stars that have since
+ * come nearer twice and leave out freshly respawned ones.  Only a frame
+ * drawn again from the same list (the simulation thread not done yet)
+ * reuses the texture, since its LOD stars are exactly the same.
+ */
+#define LOD_SCALE          4
+#define LOD_STAR_WEIGHT    32   /* brightness added per star in a cell */
+
+static int   gFarLod      = 0;
+static float gFarLodDepth = 0.8f;
+
+static SDL_Texture* lodTexture = NULL;
+static Uint16* lodCells  = NULL;
+static Uint32* lodPixels = NULL;
+static int     lodWidth  = 0;
+static int     lodHeight = 0;
+static int     lodStale  = 1;   /* the texture doesn't hold the current list yet */
+
+static void freeFarLod(void) {
+    if (lodTexture) {
+        SDL_DestroyTexture(lodTexture);
+    }
+    free(lodCells);
+    free(lodPixels);
+    lodTexture = NULL;
+    lodCells = NULL;
+    lodPixels = NULL;
+    lodWidth = 0;
+    lodHeight = 0;
+}
+
+/* (Re)size the cell grid to cover a raster target of width x height */
+static int resizeFarLod(int width, int height) {
+    int w = (width  + LOD_SCALE - 1) / LOD_SCALE;
+    int h = (height + LOD_SCALE - 1) / LOD_SCALE;
+
+    if (lodTexture && w == lodWidth && h == lodHeight) {
+        return 1;
+    }
+    freeFarLod();
+
+    lodCells  = (Uint16*)countedMalloc(w * h * sizeof(Uint16));
+    lodPixels = (Uint32*)countedMalloc(w * h * sizeof(Uint32));
+    lodTexture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_ARGB8888,
+                                   SDL_TEXTUREACCESS_STREAMING, w, h);
+    if (!lodCells || !lodPixels || !lodTexture) {
+        printf("Could not create far LOD texture! SDL_Error: %s\n", SDL_GetError());
+        freeFarLod();
+        gFarLod = 0;
+        return 0;
+    }
+    SDL_SetTextureBlendMode(lodTexture, SDL_BLENDMODE_ADD);
+    SDL_SetTextureScaleMode(lodTexture, SDL_ScaleModeLinear);
+
+    lodWidth = w;
+    lodHeight = h;
+    lodStale = 1;
+    return 1;
+}
+
+/* Count the LOD stars of this frame into the grid and upload it */
+static void splatFarLod(const DrawList* dl) {
+    const SDL_Point* pts = &dl->points[dl->capacity - dl->lodCount];
+
+    memset(lodCells, 0, lodWidth * lodHeight * sizeof(Uint16));
+    for (int i = 0; i < dl->lodCount; i++) {
+        unsigned cx = (unsigned)(pts[i].x >> dl->subpixelBits) / LOD_SCALE;
+        unsigned cy = (unsigned)(pts[i].y >> dl->subpixelBits) / LOD_SCALE;
+        if (cx < (unsigned)lodWidth && cy < (unsigned)lodHeight) {
+            Uint16* cell = &lodCells[cy * lodWidth + cx];
+            *cell += (*cell != 65535);
+        }
+    }
+
+    for (int i = 0; i < lodWidth * lodHeight; i++) {
+        Uint32 b = SDL_min((Uint32)lodCells[i] * LOD_STAR_WEIGHT, 255u);
+        lodPixels[i] = 0xFF000000u | (b * 0x010101u);
+    }
+    SDL_UpdateTexture(lodTexture, NULL, lodPixels, lodWidth * sizeof(Uint32));
+}
+
+/* Draw the far field of dl; fresh is 0 when dl is the last frame's list drawn again */
+static void drawFarLod(const DrawList* dl, int fresh) {
+    if (!resizeFarLod(scaledSize(gWidth, dl->rasterScale), scaledSize(gHeight, dl->rasterScale))) {
+        return;
+    }
+    if (fresh || lodStale) {
+        splatFarLod(dl);
+        lodStale = 0;
+    }
+
+    /* Cells are in raster pixels, so stretch them back to the window */
+    SDL_Rect dst = { 0, 0, (int)(lodWidth * LOD_SCALE / dl->rasterScale),
+                     (int)(lodHeight * LOD_SCALE / dl->rasterScale) };
+    SDL_RenderCopy(gRenderer, lodTexture, NULL, &dst);
+}
+
+/*
+ * Quality governor (--budget).  Keeps frames within gFrameBudget by
+ * walking a ladder of quality levels: level 0 is the user's settings,
+ * and each level above gives up a little more, effects first, then
+ * render scale, then trails, then stars.
+ *
+ * Late frames are found present to present, so GPU work and a missed
+ * vsync count, not just the CPU time to submit the frame.  A frame is
+ * late when its interval passes the budget, or GOVERNOR_MISSED refresh
+ * periods with vsync on (a whole refresh was skipped).  Room to spare
+ * can't be seen that way, since vsync stretches every interval to a
+ * whole refresh, so it is judged on the frame's work: the time from the
+ * start of render() to just before the present, or the simulation
+ * thread's step if that took longer.  The governor steps down as soon
+ * as more than GOVERNOR_LATE of the recent frames are late, but only
+ * steps back up after GOVERNOR_RAISE frames in a row that were on time
+ * and worked under GOVERNOR_LOW of the budget, and waits twice as long
+ * again each time a step up has to be taken back, so it settles instead
+ * of oscillating.
+ */
+#define QUALITY_STAR_LEVEL 8      /* no trails here; every level above drops stars */
+#define QUALITY_LEVELS     (QUALITY_STAR_LEVEL + 10)
+#define QUALITY_MIN_STARS  1000
+
+#define GOVERNOR_SMOOTHING 0.1f   /* weight of the newest frame in the averages */
+#define GOVERNOR_MISSED    1.5f   /* refresh periods between presents that mean a missed vsync */
+#define GOVERNOR_LATE      0.15f  /* step down above this share of late frames */
+#define GOVERNOR_LOW       0.6f   /* work under this share of the budget leaves room */
+#define GOVERNOR_SETTLE    20     /* frames for a change to show before judging it */
+#define GOVERNOR_RAISE     120    /* calm frames before the first step up */
+#define GOVERNOR_RAISE_MAX (GOVERNOR_RAISE * 16)
+
+static int   gGovernor    = 0;
+static float gFrameBudget = 16.6f;  /* ms */
+static float gRefreshMs   = 0.0f;   /* display refresh period with vsync on, else 0 */
+
+static struct {
+    int   level;
+    float avgMs;        /* smoothed present-to-present interval */
+    float lateShare;    /* smoothed share of late frames */
+    int   sinceChange;  /* frames since the level last changed */
+    int   calm;         /* frames in a row with room to spare */
+    int   raiseAfter;   /* calm frames needed to step up */
+    int   raised;       /* the last change was a step up */
+} governor = { 0, 0.0f, 0.0f, 0, 0, GOVERNOR_RAISE, 0 };
+
+/* Read the refresh period of the window's display, if presents wait for vsync */
+static void updateRefreshPeriod(void) {
+    SDL_DisplayMode mode;
+    gRefreshMs = 0.0f;
+    if ((gRendererInfo.flags & SDL_RENDERER_PRESENTVSYNC) &&
+        SDL_GetWindowDisplayMode(gWindow, &mode) == 0 && mode.refresh_rate > 0) {
+        gRefreshMs = 1000.0f / (float)mode.refresh_rate;
+    }
+}
+
+static int sliderStarCount(void) {
+    int count = (int)(starSlider * 500000.0f);
+    return count < 1 ? 1 : count;  /* Ensure at least 1 star */
+}
+
+static void qualityAtLevel(int level, Quality* q) {
+    q->motionSteps = gMotionSteps;
+    q->bloom = gBloom;
+    q->antialias = gAntialias;
+    q->renderScale = gRenderScale;
+    q->nearThreshold = NEAR_THRESHOLD;
+    q->starCount = sliderStarCount();
+
+    if (level >= 1) q->motionSteps = (q->motionSteps + 1) / 2;
+    if (level >= 2) q->motionSteps = 1;
+    if (level >= 3) q->bloom = 0;
+    if (level >= 4) q->antialias = 0;
+
+    /* Without render targets only the CPU path can draw at a lower scale */
+    if (gRasterPath == RASTER_CPU || SDL_RenderTargetSupported(gRenderer)) {
+        if (level >= 5) q->renderScale = SDL_min(q->renderScale, 0.75f);
+        if (level >= 6) q->renderScale = SDL_min(q->renderScale, 0.5f);
+    }
+
+    /* Fewer stars get trails, then none do */
+    if (level >= 7) q->nearThreshold = 0.15f;
+    if (level >= QUALITY_STAR_LEVEL) q->nearThreshold = MIN_Z;
+
+    for (int l = QUALITY_STAR_LEVEL + 1; l <= level; l++) {
+        int fewer = q->starCount * 3 / 4;
+        if (fewer >= QUALITY_MIN_STARS) {
+            q->starCount = fewer;
+        }
+    }
+}
+
+/* The nearest level in direction dir that actually changes something */
+static int nextQualityLevel(int level, int dir) {
+    Quality from, to;
+    qualityAtLevel(level, &from);
+    for (int l = level + dir; l >= 0 && l < QUALITY_LEVELS; l += dir) {
+        qualityAtLevel(l, &to);
+        if (memcmp(&from, &to, sizeof(Quality)) != 0) {
+            return l;
+        }
+    }
+    return level;
+}
+
+/* Work out this frame's settings and resize the star arrays to match */
+static void applyQuality(void) {
+    qualityAtLevel(gGovernor ? governor.level : 0, &gQuality);
+    gNearThreshold = gQuality.nearThreshold;
+    if (gQuality.starCount != starCount) {
+        allocateStars(gQuality.starCount);
+    }
+}
+
+/*
+ * Feed in the last present-to-present interval and the work of the
+ * frame it ended, and pick the next frame's level
+ */
+static void governFrame(float ms, float workMs) {
+    /* Under vsync intervals come in whole refresh periods, so only a skipped one is late */
+    float limit = SDL_max(gFrameBudget, gRefreshMs * GOVERNOR_MISSED);
+    int late = ms > limit;
+
+    governor.avgMs += (ms - governor.avgMs) * GOVERNOR_SMOOTHING;
+    governor.lateShare += ((float)late - governor.lateShare) * GOVERNOR_SMOOTHING;
+    governor.calm = !late && workMs < gFrameBudget * GOVERNOR_LOW ? governor.calm + 1 : 0;
+    governor.sinceChange++;
+
+    if (!gGovernor) {
+        governor.level = 0;
+        governor.raiseAfter = GOVERNOR_RAISE;
+        governor.raised = 0;
+        return;
+    }
+    if (governor.sinceChange < GOVERNOR_SETTLE) {
+        return;
+    }
+
+    int level = governor.level;
+    if (governor.lateShare > GOVERNOR_LATE) {
+        level = nextQualityLevel(level, 1);
+        /* Stepping straight back down means the last step up was too far */
+        if (level != governor.level && governor.raised &&
+            governor.sinceChange < governor.raiseAfter) {
+            governor.raiseAfter = SDL_min(governor.raiseAfter * 2, GOVERNOR_RAISE_MAX);
+        }
+        governor.raised = 0;
+    } else if (governor.calm >= governor.raiseAfter && level > 0) {
+        level = nextQualityLevel(level, -1);
+        governor.raised = 1;
+    }
+
+    if (level != governor.level) {
+        governor.level = level;
+        governor.sinceChange = 0;
+        governor.calm = 0;
+        governor.lateShare = 0.0f;
+    }
+}
+
+/* Window size from the last resize event, 0 once render() has applied it */
+static int pendingWidth  = 0;
+static int pendingHeight = 0;
+
+static void handleResize(int width, int height) {
+    if (height == 0) height = 1;
+
+    gWidth = width;
+    gHeight = height;
+
+    /*
+     * Re-sync the 'oldX/oldY' for each star to its 
+     * "current" position in the *new* window size.
+     * Packed stars derive it from z and need nothing.
+     */
+    if (gStarFormat == STAR_FORMAT_FULL) {
+        for (int i = 0; i < starCount; i++) {
+            float factor = PERSPECTIVE_SCALE / stars[i].z;
+            float newX = (gWidth  / 2.0f) + (stars[i].x * factor);
+            float newY = (gHeight / 2.0f) + (stars[i].y * factor);
+            stars[i].oldX = newX;
+            stars[i].oldY = newY;
+        }
+    } else {
+        forEachLaneRun(resyncLanes);
+    }
+
+    /* Pooled records were projected for the old window size */
+    flushRespawnPool();
+}
+
+static void drawStarList(DrawList* dl) {
+    int shading = dl->shaded;
+
+    /*
+     * Draw FAR STARS as points, at most one per pixel.  Anti-aliased
+     * splats, HDR accumulation and motion blur sub-frames add up, so
+     * they show density without deduplication.
+     */
+    if (!dl->subpixelBits && !gHdr && subframeWeight == 256 &&
+        (gDedupFarStars || gDensityShading) && dedupFarStars(dl)) {
+        drawFarStars(dl, shading ? dl->pointShades : NULL);
+        clearPixelHits(dl);
+    } else {
+        plotPoints(dl->points, shading ? dl->pointShades : NULL, dl->pointCount, 255,
+                   dl->subpixelBits);
+    }
+
+    /* Draw NEAR STARS as short lines (trails) */
+    drawNearStars(dl, shading ? dl->lineShades : NULL);
+}
+
+static void render() {
+    Uint64 workStart = SDL_GetPerformanceCounter();
+
+    /* Clear screen to black */
+    SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
+    SDL_RenderClear(gRenderer);
+
+    /* Set draw color to white for stars */
+    SDL_SetRenderDrawColor(gRenderer, 255, 255, 255, 255);
+
+    /*
+     * 1. Move the stars and project them into the draw list, or take
+     * the frame the simulation thread has finished.  If it hasn't, the
+     * last frame is drawn again and settings wait until it has.
+     */
+    int owned = sim.thread ? takeSimFrame() : 1;
+    int steps = 1;
+    if (owned) {
+        if (!gSimThread && sim.thread) {
+            stopSimulation();
+        }
+        if (pendingWidth) {
+            handleResize(pendingWidth, pendingHeight);
+            pendingWidth = 0;
+        }
+        if (speedSlider * 2.0f != gSpeedScale) {
+            /* Update all existing stars with new speed */
+            randomizeSpeeds();
+        }
+        applyQuality();
+        prepareStarLayer();
+        steps = (layerActive && layerPath == RASTER_CPU) ? gQuality.motionSteps : 1;
+        gFrameStep = 1.0f / steps;
+        gLodThreshold = gFarLod ? gFarLodDepth : 2.0f;
+        gShadeStars = gDepthShading || gStarTint;
+        if (!sim.thread) {
+            updateStars();
+            projectStars(&gDrawList);
+        } else {
+            matchDrawList(&sim.lists[sim.front]);
+        }
+    }
+    DrawList* dl = sim.thread ? &sim.lists[sim.front] : &gDrawList;
+
+    /* The far-field texture goes under everything else */
+    if (gFarLod) {
+        drawFarLod(dl, owned);
+    } else {
+        lodStale = 1;
+    }
+
+    /* Stars go to the persistent layer when trails or the CPU path are on */
+    beginStarLayer();
+
+    if (dl->shaded) {
+        updateShadeTable();
+    }
+
+    /* 2. Draw the stars, then any further motion blur sub-frames */
+    for (int step = 0; step < steps; step++) {
+        if (step > 0) {
+            updateStars();
+            projectStars(dl);
+        }
+        subframeWeight = motionWeight(step, steps);
+        drawStarList(dl);
+    }
+    subframeWeight = 256;
+
+    endStarLayer();
+
+    /* The stars are free again, so the next frame can be simulated meanwhile */
+    if (owned && gSimThread) {
+        if (sim.thread) {
+            SDL_SemPost(sim.go);
+        } else {
+            startSimulation();
+        }
+    }
+
+    /*
+     * 3. Draw the UI windows using Nuklear.  The backend only redraws its
+     * overlay texture when the UI's commands change, so values that
+     * change every frame are shown at a few updates per second (FPS is
+     * already measured once a second).
+     */
+    static Uint32 uiRefreshedAt = 0;
+    static float shownFrameMs = 0.0f;
+    Uint32 uiNow = SDL_GetTicks();
+    if (uiNow - uiRefreshedAt >= UI_REFRESH_MS) {
+        shownFrameMs = governor.avgMs;
+        uiRefreshedAt = uiNow;
+    }
+    struct nk_style *style = &ctx->style;
+    struct nk_color bg = nk_rgba(0, 0, 0, 200);
+    style->window.background = nk_rgba(0, 0, 0, 200);
+    style->window.fixed_background = nk_style_item_color(bg);
+    style->window.padding = nk_vec2(8, 8);
+    
+    /* Info window (bottom left) */
+    if (nk_begin(ctx, "Info", nk_rect(10, gHeight - 99, 180, 84),
+        NK_WINDOW_NO_SCROLLBAR|NK_WINDOW_NO_INPUT)) {
+        
+        char buf[64];
+        sprintf(buf, "FPS: %.2f", gFPS);
+        
+        nk_layout_row_dynamic(ctx, 20, 1);
+        nk_label_colored(ctx, gRendererInfo.name, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        nk_label_colored(ctx, buf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+
+        /* Heap allocations since the last frame; 0 once everything has warmed up */
+        static Uint64 lastAllocs = 0;
+        Uint64 allocs = heapAllocations();
+        char allocBuf[48];
+        sprintf(allocBuf, "Allocs: %lu (+%lu)", (unsigned long)allocs,
+            (unsigned long)(allocs - lastAllocs));
+        lastAllocs = allocs;
+        nk_label_colored(ctx, allocBuf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+    }
+    nk_end(ctx);
+
+    /* Settings window (bottom right) */
+    if (nk_begin(ctx, "Settings", nk_rect(gWidth - 320, gHeight - 435, 300, 430),
+        NK_WINDOW_NO_SCROLLBAR)) {
+        
+        nk_layout_row_dynamic(ctx, 20, 1);
+        
+        char buf[32];
+        sprintf(buf, "Stars: %d", starCount);
+        nk_label_colored(ctx, buf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        
+        nk_slider_float(ctx, 0, &starSlider, 1.0f, 0.01f);
+        
+        char speedBuf[32];
+        sprintf(speedBuf, "Speed: %.2fx", speedSlider * 2.0f);
+        nk_label_colored(ctx, speedBuf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        nk_slider_float(ctx, 0, &speedSlider, 1.0f, 0.01f);
+
+        nk_layout_row_dynamic(ctx, 20, 2);
+        nk_checkbox_label(ctx, "Dedup far", &gDedupFarStars);
+        nk_checkbox_label(ctx, "Density", &gDensityShading);
+        nk_checkbox_label(ctx, "Far LOD", &gFarLod);
+        nk_slider_float(ctx, 0.5f, &gFarLodDepth, 1.0f, 0.01f);
+        nk_checkbox_label(ctx, "Trails", &gTrails);
+        nk_slider_float(ctx, 0.5f, &gTrailDecay, 0.98f, 0.01f);
+
+        int cpuRaster = gRasterPath == RASTER_CPU;
+        nk_checkbox_label(ctx, "CPU raster", &cpuRaster);
+        gRasterPath = cpuRaster ? RASTER_CPU : RASTER_SDL;
+        nk_checkbox_label(ctx, "Smooth (CPU)", &gAntialias);
+        nk_checkbox_label(ctx, "Depth shade", &gDepthShading);
+        nk_checkbox_label(ctx, "Star colour", &gStarTint);
+        nk_checkbox_label(ctx, "HDR", &gHdr);
+        nk_slider_float(ctx, 0.25f, &gExposure, 4.0f, 0.05f);
+        nk_checkbox_label(ctx, "Bloom (CPU)", &gBloom);
+        nk_slider_float(ctx, 0.0f, &gBloomStrength, 8.0f, 0.1f);
+
+        char blurBuf[32];
+        sprintf(blurBuf, "Sub-frames: %d", gMotionSteps);
+        nk_label_colored(ctx, blurBuf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        nk_slider_int(ctx, 1, &gMotionSteps, MAX_MOTION_STEPS, 1);
+
+        static const char* upscaleNames[] = { "Nearest", "Bilinear", "Sharpen" };
+        char scaleBuf[32];
+        sprintf(scaleBuf, "Scale: %.2f", gRenderScale);
+        nk_label_colored(ctx, scaleBuf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        nk_slider_float(ctx, 0.25f, &gRenderScale, 1.0f, 0.05f);
+        nk_label_colored(ctx, "Upscale", NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        gUpscale = (Upscale)nk_combo(ctx, upscaleNames, 3, gUpscale, 20, nk_vec2(140, 90));
+
+        nk_layout_row_dynamic(ctx, 20, 1);
+        char budgetBuf[48];
+        sprintf(budgetBuf, "Frame: %.1f / %.1f ms, level %d", shownFrameMs, gFrameBudget,
+            gGovernor ? governor.level : 0);
+        nk_label_colored(ctx, budgetBuf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+        nk_layout_row_dynamic(ctx, 20, 2);
+        nk_checkbox_label(ctx, "Governor", &gGovernor);
+        nk_slider_float(ctx, 4.0f, &gFrameBudget, 33.3f, 0.1f);
+        nk_checkbox_label(ctx, "Sim thread", &gSimThread);
+
+        /* Star count and speed changes take effect at the start of the next frame */
+    }
+    nk_end(ctx);
+
+    /* Render Nuklear */
+    nk_sdl_render(NK_ANTI_ALIASING_ON);
+
+    /* The frame's work, before the present can wait for vsync */
+    const double msPerTick = 1e3 / (double)SDL_GetPerformanceFrequency();
+    float workMs = (float)((double)(SDL_GetPerformanceCounter() - workStart) * msPerTick);
+    if (sim.thread) {
+        workMs = SDL_max(workMs, (float)SDL_AtomicGet(&sim.stepUs) * 1e-3f);
+    }
+
+    /* Present the final frame */
+    SDL_RenderPresent(gRenderer);
+
+    /* Time the whole frame, GPU and vsync included, from the last present to this one */
+    static Uint64 lastPresent = 0;
+    Uint64 presented = SDL_GetPerformanceCounter();
+    if (lastPresent) {
+        governFrame((float)((double)(presented - lastPresent) * msPerTick), workMs);
+    }
+    lastPresent = presented;
+}
+
+/*
+ * Benchmark mode (--bench): times the per-frame simulation work, i.e.
+ * update plus projection into the draw list, for each star format at
+ * a few star counts.  No window is opened.
+ */
+#define BENCH_STAR_UPDATES 20000000  /* star updates timed per run */
+
+#define BENCH_STR(x)  #x
+#define BENCH_XSTR(x) BENCH_STR(x)
+
+static const char* starFormatName(StarFormat format) {
+    static const char* names[] = { "full", "packed", "soa", "aosoa" BENCH_XSTR(STAR_BLOCK) };
+    return names[format];
+}
+
+static int starFormatBytes(StarFormat format) {
+    return format == STAR_FORMAT_PACKED ? (int)sizeof(PackedStar) : (int)sizeof(Star);
+}
+
+static double benchStarFormat(StarFormat format, int count) {
+    int frames = BENCH_STAR_UPDATES / count;
+    if (frames < 10) frames = 10;
+
+    freeStars();
+    flushRespawnPool();
+    gStarFormat = format;
+    if (!allocateStars(count)) {
+        return -1.0;
+    }
+
+    /* Warm up caches and the respawn pool */
+    for (int f = 0; f < 5; f++) {
+        updateStars();
+        projectStars(&gDrawList);
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < frames; f++) {
+        updateStars();
+        projectStars(&gDrawList);
+    }
+    Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+
+    freeStars();
+    return (double)elapsed * 1e9 / (double)SDL_GetPerformanceFrequency()
+           / ((double)frames * (double)count);
+}
+
+/*
+ * spawnStars() must place stars exactly like the rejection sampler it
+ * replaced: uniform over the square minus the MIN_RADIUS disk.  Both
+ * samplers (and the hashed one respawns overflow to) fill a grid of
+ * x/y cells over the square, so a sampler that gets radius right but
+ * skews it with angle (say, in the corners) shows up too, and a
+ * two-sample chi-square test on the grid fails the benchmark if they
+ * differ beyond the p = 0.001 level.
+ */
+#define SPAWN_TEST_STARS 1000000
+#define SPAWN_TEST_GRID  32     /* cells per side of the square */
+#define SPAWN_TEST_CELLS (SPAWN_TEST_GRID * SPAWN_TEST_GRID)
+#define SPAWN_CHI2_Z     3.09   /* standard normal quantile for p = 0.001 */
+
+static void binSpawnedStar(const Star* star, int* cells) {
+    int cx = (int)((star->x + 1.0f) * (SPAWN_TEST_GRID / 2));
+    int cy = (int)((star->y + 1.0f) * (SPAWN_TEST_GRID / 2));
+    cells[SDL_clamp(cy, 0, SPAWN_TEST_GRID - 1) * SPAWN_TEST_GRID +
+          SDL_clamp(cx, 0, SPAWN_TEST_GRID - 1)]++;
+}
+
+/*
+ * Two-sample chi-square statistic for equal-sized samples.  Cells that
+ * neither sample hits (inside the disk) don't count towards *df.
+ */
+static double chiSquare(const int* a, const int* b, int bins, int* df) {
+    double chi2 = 0.0;
+    *df = -1;
+    for (int i = 0; i < bins; i++) {
+        double sum = (double)a[i] + (double)b[i];
+        if (sum > 0.0) {
+            double diff = (double)a[i] - (double)b[i];
+            chi2 += diff * diff / sum;
+            (*df)++;
+        }
+    }
+    return chi2;
+}
+
+/* Chi-square value exceeded with p = 0.001 at df degrees of freedom (Wilson-Hilferty) */
+static double chiSquareLimit(int df) {
+    double k = 2.0 / (9.0 * SDL_max(df, 1));
+    double c = 1.0 - k + SPAWN_CHI2_Z * sqrt(k);
+    return df * c * c * c;
+}
+
+static int benchSpawnDistribution(void) {
+    static const char* names[] = { "batch", "hashed" };
+    static int ref[SPAWN_TEST_CELLS], cells[SPAWN_TEST_CELLS];
+    const float a = MIN_RADIUS * MIN_RADIUS;
+    const SpawnParams params = spawnParams();
+    int ok = 1;
+
+    /* Reference: the original rejection sampler */
+    memset(ref, 0, sizeof(ref));
+    for (int i = 0; i < SPAWN_TEST_STARS; i++) {
+        Star star;
+        do {
+            star.x = 2.0f * (randFloat() - 0.5f);
+            star.y = 2.0f * (randFloat() - 0.5f);
+        } while (star.x * star.x + star.y * star.y < a);
+        binSpawnedStar(&star, ref);
+    }
+
+    printf("\n%-8s %10s %10s %10s\n", "spawn", "cells", "x/y chi2", "limit");
+    for (int s = 0; s < 2; s++) {
+        Star batch[SPAWN_BATCH];
 
-/* Nuklear implementation */
-#define NK_INCLUDE_FIXED_TYPES
-#define NK_INCLUDE_STANDARD_IO
-#define NK_INCLUDE_STANDARD_VARARGS
-#define NK_INCLUDE_DEFAULT_ALLOCATOR
-#define NK_INCLUDE_VERTEX_BUFFER_OUTPUT
-#define NK_INCLUDE_FONT_BAKING
-#define NK_INCLUDE_DEFAULT_FONT
-#define NK_IMPLEMENTATION
-#include "nuklear.h"
-#define NK_SDL_RENDERER_IMPLEMENTATION
-#include "nuklear_sdl_renderer.h"
+        memset(cells, 0, sizeof(cells));
+        for (int base = 0; base < SPAWN_TEST_STARS; base += SPAWN_BATCH) {
+            int n = SDL_min(SPAWN_BATCH, SPAWN_TEST_STARS - base);
+            if (s == 0) {
+                spawnStars(batch, n);
+            } else {
+                for (int i = 0; i < n; i++) {
+                    spawnHashedStar(&batch[i], &params, (Uint32)(base + i));
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                binSpawnedStar(&batch[i], cells);
+            }
+        }
 
-/* Window dimensions */
-#define WINDOW_WIDTH  1280
-#define WINDOW_HEIGHT 720
+        int df;
+        double chi2 = chiSquare(ref, cells, SPAWN_TEST_CELLS, &df);
+        double limit = chiSquareLimit(df);
+        printf("%-8s %10d %10.1f %10.1f\n", names[s], df + 1, chi2, limit);
+        if (chi2 > limit) {
+            printf("%s spawning does not match the rejection sampler!\n", names[s]);
+            ok = 0;
+        }
+    }
+    return ok;
+}
 
-/* Star count and speed control */
-static int starCount = 10000;
-static float starSlider = 0.02f;  /* 0.02 = 10000 stars, 1.0 = 500000 stars */
-static float speedSlider = 0.5f;  /* Controls star movement speed: 0=stop, 0.5=normal, 1.0=2x */
+/*
+ * Every --rcp precision must land within RCP_MAX_PIXEL_ERROR pixels of
+ * the exact divide.  The benchmark checks this on both star formats
+ * and fails if it doesn't hold.
+ */
+#define RCP_MAX_PIXEL_ERROR 1
+#define RCP_BENCH_STARS     1000000
+#define RCP_BENCH_PASSES    10
 
-/* Reset a star if it gets too close to the viewer */
-#define MIN_Z 0.05f
+static const char* rcpPrecisionName(RcpPrecision precision) {
+    static const char* names[] = { "exact", "fast", "precise" };
+    return names[precision];
+}
 
-/* Avoid placing a star too close to the center to prevent big streaks */
-#define MIN_RADIUS 0.1f
+static int maxPixelError(const DrawList* a, const DrawList* b) {
+    int err = 0;
 
-/* Perspective calculation for dramatic starfield effect */
-#define PERSPECTIVE_SCALE 150.0f
+    if (a->pointCount != b->pointCount || a->lineCount != b->lineCount) {
+        return INT_MAX;
+    }
+    for (int i = 0; i < a->pointCount; i++) {
+        err = SDL_max(err, abs(a->points[i].x - b->points[i].x));
+        err = SDL_max(err, abs(a->points[i].y - b->points[i].y));
+    }
+    for (int i = 0; i < 2 * a->lineCount; i++) {
+        err = SDL_max(err, abs(a->lines[i].x - b->lines[i].x));
+        err = SDL_max(err, abs(a->lines[i].y - b->lines[i].y));
+    }
+    return err;
+}
 
-/* Draw trails for stars that are close enough */
-#define NEAR_THRESHOLD 0.3f
+static int benchRcpPrecision(void) {
+    const int count = RCP_BENCH_STARS;
+    RcpPrecision saved = gRcpPrecision;
+    DrawList exactFull = { 0 }, exactPacked = { 0 };
+    exactFull.rasterScale = exactPacked.rasterScale = gDrawList.rasterScale = 1.0f;
+    int ok = 1;
 
-SDL_Window* gWindow = NULL;
-SDL_Renderer* gRenderer = NULL;
+    Star* ref = (Star*)malloc(count * sizeof(Star));
+    Star* work = (Star*)malloc(count * sizeof(Star));
+    PackedStar* packed = (PackedStar*)malloc(count * sizeof(PackedStar));
+    if (!ref || !work || !packed ||
+        !reserveDrawList(&exactFull, count) || !reserveDrawList(&exactPacked, count) ||
+        !reserveDrawList(&gDrawList, count)) {
+        printf("Could not allocate %d stars!\n", count);
+        ok = 0;
+        goto done;
+    }
 
-struct nk_context* ctx = NULL;
+    spawnStars(ref, count);
+    for (int i = 0; i < count; i++) {
+        packed[i] = packStar(&ref[i]);
+    }
 
-#define BASE_SPEED 0.001f
-#define SPEED_RANGE 0.009f
+    /* Reference projections with the exact divide */
+    gRcpPrecision = RCP_EXACT;
+    memcpy(work, ref, count * sizeof(Star));
+    projectFullStars(work, count, &exactFull);
+    projectPackedStars(packed, count, &exactPacked);
 
-typedef struct {
-    float x, y, z;    /* 3D position in [-1..1] for x,y, and (0..1] for z */
-    float oldX, oldY; /* Last frame's 2D screen position in pixels */
-    float speed;      /* Speed at which z decreases */
-} Star;
+    printf("\n%-8s %10s %10s %10s\n", "rcp", "ns/star", "full px", "packed px");
+    for (int p = RCP_EXACT; p <= RCP_PRECISE; p++) {
+        gRcpPrecision = (RcpPrecision)p;
 
-static int gWidth  = WINDOW_WIDTH;
-static int gHeight = WINDOW_HEIGHT;
+        memcpy(work, ref, count * sizeof(Star));
+        reserveDrawList(&gDrawList, count);
+        projectFullStars(work, count, &gDrawList);
+        int fullErr = maxPixelError(&exactFull, &gDrawList);
 
-static float gFPS    = 0.0f;
-static int   gFrames = 0;
-static Uint32 gLastTime = 0;
+        reserveDrawList(&gDrawList, count);
+        projectPackedStars(packed, count, &gDrawList);
+        int packedErr = maxPixelError(&exactPacked, &gDrawList);
 
-static SDL_RendererInfo gRendererInfo;
+        /* Time the full-format projection on its own */
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int pass = 0; pass < RCP_BENCH_PASSES; pass++) {
+            reserveDrawList(&gDrawList, count);
+            projectFullStars(work, count, &gDrawList);
+        }
+        double ns = (double)(SDL_GetPerformanceCounter() - start) * 1e9
+                    / (double)SDL_GetPerformanceFrequency()
+                    / ((double)RCP_BENCH_PASSES * (double)count);
 
-static float randFloat() {
-    return (float)rand() / (float)RAND_MAX;
+        printf("%-8s %10.2f %10d %10d\n", rcpPrecisionName(gRcpPrecision), ns, fullErr, packedErr);
+        if (fullErr > RCP_MAX_PIXEL_ERROR || packedErr > RCP_MAX_PIXEL_ERROR) {
+            printf("rcp %s is off by more than %d pixel(s)!\n",
+                rcpPrecisionName(gRcpPrecision), RCP_MAX_PIXEL_ERROR);
+            ok = 0;
+        }
+    }
+
+done:
+    gRcpPrecision = saved;
+    freeDrawList(&exactFull);
+    freeDrawList(&exactPacked);
+    free(ref);
+    free(work);
+    free(packed);
+    return ok;
 }
 
-static Star* stars = NULL;
+/*
+ * Set up an off-screen CPU raster layer of the window size and count
+ * full-format stars, and let every star respawn once so the near/far
+ * mix is steady, for the benchmarks below that draw whole frames.
+ */
+#define CPU_BENCH_WARMUP 300
 
-static int allocateStars(int count) {
-    Star* newStars = (Star*)realloc(stars, count * sizeof(Star));
-    if (!newStars) {
+static int beginCpuBench(int count) {
+    freeStars();
+    flushRespawnPool();
+    gStarFormat = STAR_FORMAT_FULL;
+    cpuPixels = (Uint32*)calloc(gWidth * gHeight, sizeof(Uint32));
+    if (!cpuPixels || !allocateStars(count)) {
+        printf("Could not allocate %d stars!\n", count);
+        free(cpuPixels);
+        cpuPixels = NULL;
         return 0;
     }
-    
-    /* Initialize new stars if array grew */
-    if (count > starCount) {
-        for (int i = starCount; i < count; i++) {
-            float r2 = 0.0f;
-            float z = 0.1f + 0.9f * randFloat();
-            float x, y;
-            do {
-                x = 2.0f * (randFloat() - 0.5f);
-                y = 2.0f * (randFloat() - 0.5f);
-                r2 = x*x + y*y;
-            } while (r2 < (MIN_RADIUS * MIN_RADIUS));
-
-            newStars[i].x = x;
-            newStars[i].y = y;
-            newStars[i].z = z;
-            newStars[i].speed = (BASE_SPEED + SPEED_RANGE * randFloat()) * (speedSlider * 2.0f);
-
-            float factor = PERSPECTIVE_SCALE / z;
-            newStars[i].oldX = (gWidth  / 2.0f) + (x * factor);
-            newStars[i].oldY = (gHeight / 2.0f) + (y * factor);
-        }
+    layerWidth = gWidth;
+    layerHeight = gHeight;
+    layerPath = RASTER_CPU;
+    layerActive = 1;
+
+    for (int f = 0; f < CPU_BENCH_WARMUP; f++) {
+        updateStars();
+        projectStars(&gDrawList);
     }
-    
-    stars = newStars;
-    starCount = count;
     return 1;
 }
 
-static void initStar(int i) {
-    float r2 = 0.0f;
+static void endCpuBench(void) {
+    layerActive = 0;
+    layerWidth = 0;
+    layerHeight = 0;
+    free(cpuPixels);
+    cpuPixels = NULL;
+    free(pixelHits);
+    pixelHits = NULL;
+    pixelHitsSize = 0;
+    freeStars();
+}
 
-    /* Random z in [0.1..1.0], i.e. "distance." */
-    float z = 0.1f + 0.9f * randFloat();
+/*
+ * Cost of star shading: whole frames of SHADE_BENCH_STARS stars drawn
+ * on the CPU raster path into an off-screen framebuffer, monochrome and
+ * with depth shading and tint, plus the sort the SDL path adds per frame.
+ * The sort is timed against projection and dedup alone, since SDL's own
+ * submission can't be timed here; its share of a real SDL frame is smaller.
+ */
+#define SHADE_BENCH_STARS  1000000
+#define SHADE_BENCH_FRAMES 20
 
-    /*
-     * Keep picking (x,y) in [-1..1] until 
-     * we get one that is outside the MIN_RADIUS.
-     */
-    float x, y;
-    do {
-        x = 2.0f * (randFloat() - 0.5f);  /* in [-1..1] */
-        y = 2.0f * (randFloat() - 0.5f);
-        r2 = x*x + y*y;
-    } while (r2 < (MIN_RADIUS * MIN_RADIUS));
+/* One frame's draw-side work; returns performance counter ticks */
+static Uint64 benchShadedFrame(int shading, int sdlSort) {
+    gDepthShading = shading;
+    gStarTint = shading;
+    gShadeStars = shading;
+    updateShadeTable();
+    updateStars();
 
-    stars[i].x = x;
-    stars[i].y = y;
-    stars[i].z = z;
+    Uint64 start = SDL_GetPerformanceCounter();
+    projectStars(&gDrawList);
+    const Uint8* pointShades = shading ? gDrawList.pointShades : NULL;
+    const Uint8* lineShades = shading ? gDrawList.lineShades : NULL;
+    dedupFarStars(&gDrawList);
+    if (!sdlSort) {
+        memset(cpuPixels, 0, layerWidth * layerHeight * sizeof(Uint32));
+        plotPoints(gDrawList.points, pointShades, gDrawList.pointCount, 255,
+                   gDrawList.subpixelBits);
+        drawNearStars(&gDrawList, lineShades);
+    } else if (shading) {
+        sortByShade(gDrawList.points, pointShades, gDrawList.pointCount, 1);
+        sortByShade(gDrawList.lines, lineShades, gDrawList.lineCount, 2);
+    }
+    clearPixelHits(&gDrawList);
+    return SDL_GetPerformanceCounter() - start;
+}
 
-    /* Speed controlled by slider: 0=stop, 0.5=normal, 1.0=2x */
-    stars[i].speed = (BASE_SPEED + SPEED_RANGE * randFloat()) * (speedSlider * 2.0f);
+static int benchShading(void) {
+    if (!beginCpuBench(SHADE_BENCH_STARS)) {
+        return 0;
+    }
 
-    /* 
-     * Immediately compute the star's new screen position
-     * and set oldX, oldY to that same position,
-     * so the star doesn't produce a big line in the first frame.
-     */
-    {
-        float factor = PERSPECTIVE_SCALE / stars[i].z;
-        float newX = (gWidth  / 2.0f) + (stars[i].x * factor);
-        float newY = (gHeight / 2.0f) + (stars[i].y * factor);
+    /* Interleave the variants so drift in the star mix hits all of them */
+    Uint64 ticks[2][2] = { { 0, 0 }, { 0, 0 } };
+    for (int f = 0; f < SHADE_BENCH_FRAMES; f++) {
+        for (int sdlSort = 0; sdlSort < 2; sdlSort++) {
+            /* Swap the order each frame so neither always runs on a warm cache */
+            for (int k = 0; k < 2; k++) {
+                int shading = k ^ (f & 1);
+                ticks[sdlSort][shading] += benchShadedFrame(shading, sdlSort);
+            }
+        }
+    }
+    double scale = 1e9 / (double)SDL_GetPerformanceFrequency()
+                   / ((double)SHADE_BENCH_FRAMES * (double)starCount);
+    double mono = ticks[0][0] * scale;
+    double shaded = ticks[0][1] * scale;
+    double unsorted = ticks[1][0] * scale;
+    double sorted = ticks[1][1] * scale;
+
+    printf("\n%-8s %10s %10s\n", "shading", "ns/star", "overhead");
+    printf("%-8s %10.2f %10s\n", "mono", mono, "-");
+    printf("%-8s %10.2f %9.1f%%\n", "shaded", shaded, 100.0 * (shaded - mono) / mono);
+    printf("%-8s %10.2f %9.1f%%\n", "sdl sort", sorted, 100.0 * (sorted - unsorted) / unsorted);
+
+    gDepthShading = 0;
+    gStarTint = 0;
+    gShadeStars = 0;
+    free(shadeSorted);
+    shadeSorted = NULL;
+    shadeCapacity = 0;
+    endCpuBench();
+    return 1;
+}
+
+/*
+ * Cost of motion blur: whole frames of BLUR_BENCH_STARS stars on the
+ * CPU raster path for a few sub-frame counts, which should scale about
+ * linearly with the count.
+ */
+#define BLUR_BENCH_STARS  200000
+#define BLUR_BENCH_FRAMES 20
+
+static int benchMotionBlur(void) {
+    static const int steps[] = { 1, 2, 4, 8 };
+
+    if (!beginCpuBench(BLUR_BENCH_STARS)) {
+        return 0;
+    }
 
-        stars[i].oldX = newX;
-        stars[i].oldY = newY;
+    printf("\n%-8s %10s %10s %10s\n", "blur", "sub-frames", "ms/frame", "vs 1");
+    double base = 0.0;
+    for (size_t k = 0; k < sizeof(steps) / sizeof(steps[0]); k++) {
+        gFrameStep = 1.0f / steps[k];
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < BLUR_BENCH_FRAMES; f++) {
+            memset(cpuPixels, 0, layerWidth * layerHeight * sizeof(Uint32));
+            for (int step = 0; step < steps[k]; step++) {
+                updateStars();
+                projectStars(&gDrawList);
+                subframeWeight = motionWeight(step, steps[k]);
+                drawStarList(&gDrawList);
+            }
+        }
+        double ms = (double)(SDL_GetPerformanceCounter() - start) * 1e3
+                    / (double)SDL_GetPerformanceFrequency() / BLUR_BENCH_FRAMES;
+        if (k == 0) {
+            base = ms;
+        }
+        printf("%-8s %10d %10.2f %9.2fx\n", "frame", steps[k], ms, ms / base);
     }
+
+    gFrameStep = 1.0f;
+    subframeWeight = 256;
+    endCpuBench();
+    return 1;
 }
 
-static int initStars() {
-    if (!allocateStars(starCount)) {
+/*
+ * Draw time against render scale: SCALE_BENCH_STARS stars drawn on the
+ * CPU raster path for a 4K window, plus the sharpen filter below full
+ * size.  Trails are long at 4K, so fill is most of the drawing.
+ */
+#define SCALE_BENCH_STARS  200000
+#define SCALE_BENCH_FRAMES 20
+#define SCALE_BENCH_WIDTH  3840
+#define SCALE_BENCH_HEIGHT 2160
+
+static int benchRenderScale(void) {
+    static const float scales[] = { 1.0f, 0.75f, 0.5f, 0.25f };
+    int savedWidth = gWidth, savedHeight = gHeight;
+
+    gWidth = SCALE_BENCH_WIDTH;
+    gHeight = SCALE_BENCH_HEIGHT;
+    if (!beginCpuBench(SCALE_BENCH_STARS)) {
+        gWidth = savedWidth;
+        gHeight = savedHeight;
         return 0;
     }
-    for (int i = 0; i < starCount; i++) {
-        initStar(i);
+
+    printf("\n%-8s %10s %10s %10s %10s\n", "scale", "raster", "draw ms", "sharpen ms", "vs 1.0");
+    double base = 0.0;
+    for (size_t k = 0; k < sizeof(scales) / sizeof(scales[0]); k++) {
+        gRasterScale = scales[k];
+        layerWidth = scaledSize(gWidth, scales[k]);
+        layerHeight = scaledSize(gHeight, scales[k]);
+
+        /* The simulation costs the same at any scale, so only time the drawing */
+        Uint64 draw = 0, sharpen = 0;
+        for (int f = 0; f < SCALE_BENCH_FRAMES; f++) {
+            updateStars();
+            Uint64 start = SDL_GetPerformanceCounter();
+            memset(cpuPixels, 0, layerWidth * layerHeight * sizeof(Uint32));
+            projectStars(&gDrawList);
+            drawStarList(&gDrawList);
+            Uint64 mid = SDL_GetPerformanceCounter();
+            if (scales[k] < 1.0f) {
+                sharpenPixels(cpuPixels, layerWidth, layerHeight);
+            }
+            draw += mid - start;
+            sharpen += SDL_GetPerformanceCounter() - mid;
+        }
+        double toMs = 1e3 / (double)SDL_GetPerformanceFrequency() / SCALE_BENCH_FRAMES;
+        double ms = draw * toMs;
+        if (k == 0) {
+            base = ms;
+        }
+        printf("%-8.2f %5dx%-4d %10.2f %10.2f %9.2fx\n", scales[k], layerWidth, layerHeight,
+            ms, sharpen * toMs, (ms + sharpen * toMs) / base);
+        free(sharpPixels);
+        sharpPixels = NULL;
     }
+
+    gRasterScale = 1.0f;
+    endCpuBench();
+    gWidth = savedWidth;
+    gHeight = savedHeight;
     return 1;
 }
 
-static void updateStars() {
-    for (int i = 0; i < starCount; i++) {
-        /* 1) Store old projected position. */
-        float factorOld = PERSPECTIVE_SCALE / stars[i].z;
-        stars[i].oldX = (gWidth  / 2.0f) + (stars[i].x * factorOld);
-        stars[i].oldY = (gHeight / 2.0f) + (stars[i].y * factorOld);
+/*
+ * Cost of bloom on a 1080p frame with a sprinkling of stars and
+ * streaks, on one thread and on the whole pool.  The single thread time
+ * is what every host can check: it fails over BLOOM_WORK_MS, which
+ * leaves room for the 2 ms a frame's post-process can have on 8 threads
+ * even if they only manage 4 times the speed of one.
+ */
+#define BLOOM_BENCH_WIDTH    1920
+#define BLOOM_BENCH_HEIGHT   1080
+#define BLOOM_BENCH_FRAMES   50
+#define BLOOM_WORK_MS        8.0
 
-        /* 2) Move star forward (decrease z). */
-        stars[i].z -= stars[i].speed;
+/* Milliseconds per bloomed frame */
+static double timeBloom(const Uint32* frame) {
+    applyBloom(frame, BLOOM_BENCH_WIDTH, BLOOM_BENCH_HEIGHT);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < BLOOM_BENCH_FRAMES; f++) {
+        applyBloom(frame, BLOOM_BENCH_WIDTH, BLOOM_BENCH_HEIGHT);
+    }
+    return (double)(SDL_GetPerformanceCounter() - start) * 1e3
+           / (double)SDL_GetPerformanceFrequency() / BLOOM_BENCH_FRAMES;
+}
 
-        /* 3) If star is too close, reinit it far away. */
-        if (stars[i].z < MIN_Z) {
-            initStar(i);
+static int benchBloom(void) {
+    const int n = BLOOM_BENCH_WIDTH * BLOOM_BENCH_HEIGHT;
+    Uint32* frame = (Uint32*)calloc(n, sizeof(Uint32));
+    if (!frame || !resizeBloom(BLOOM_BENCH_WIDTH, BLOOM_BENCH_HEIGHT)) {
+        printf("Could not allocate bloom buffers!\n");
+        free(frame);
+        return 0;
+    }
+    for (int i = 0; i < n / 100; i++) {
+        int p = rand() % (n - 8);
+        for (int k = 0; k < 1 + (i & 7); k++) {
+            frame[p + k] = 0xFFFFFFFFu;
         }
     }
+
+    /* With the count at 0 every range runs inline; the workers stay parked */
+    applyBloom(frame, BLOOM_BENCH_WIDTH, BLOOM_BENCH_HEIGHT);   /* starts the pool */
+    int workers = pool.count;
+    pool.count = 0;
+    double one = timeBloom(frame);
+    pool.count = workers;
+    double all = workers > 0 ? timeBloom(frame) : one;
+
+    printf("\n%-8s %10s %10s %10s\n", "bloom", "size", "threads", "ms");
+    printf("%-8s %5dx%-4d %10d %10.2f\n", "frame", BLOOM_BENCH_WIDTH, BLOOM_BENCH_HEIGHT, 1, one);
+    if (workers > 0) {
+        printf("%-8s %5dx%-4d %10d %10.2f\n", "frame", BLOOM_BENCH_WIDTH, BLOOM_BENCH_HEIGHT,
+            workers + 1, all);
+    }
+
+    int ok = 1;
+    if (one > BLOOM_WORK_MS) {
+        printf("bloom takes over %.1f ms on one thread!\n", BLOOM_WORK_MS);
+        ok = 0;
+    }
+
+    free(frame);
+    freeBloom();
+    return ok;
 }
 
-static void render() {
-    /* Clear screen to black */
-    SDL_SetRenderDrawColor(gRenderer, 0, 0, 0, 255);
-    SDL_RenderClear(gRenderer);
+/*
+ * Memory bandwidth between NUMA nodes: for every node, a buffer is
+ * first touched by threads pinned to that node's CPUs, then read by
+ * threads pinned to each node in turn.  The diagonal is local
+ * bandwidth, the rest what a worker pays for stars on another node.
+ * Nodes come from sysfs on Linux; elsewhere, or without pinning, all
+ * CPUs count as one node.  --affinity limits the CPUs used.
+ */
+#define MAX_NODES          8
+#define NODE_BENCH_BYTES   (128 << 20)
+#define NODE_BENCH_PASSES  4
+#define NODE_BENCH_THREADS 16   /* per node */
 
-    /* Set draw color to white for stars */
-    SDL_SetRenderDrawColor(gRenderer, 255, 255, 255, 255);
+/* CPUs of each node, from sysfs cpulists */
+static int readNodeCpus(CpuSet nodeCpus[MAX_NODES]) {
+    int nodes = 0;
+#if defined(__linux__)
+    for (int node = 0; node < MAX_NODES; node++) {
+        char path[64], list[4096];
+        sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* f = fopen(path, "r");
+        if (!f) {
+            break;
+        }
+        /* Nodes without CPUs (memory only) have an empty list */
+        if (fgets(list, sizeof(list), f) && parseCpuList(list, &nodeCpus[nodes])) {
+            nodes++;
+        }
+        fclose(f);
+    }
+#endif
+    if (nodes == 0) {
+        int count = SDL_min(SDL_GetCPUCount(), MAX_CPUS);
+        memset(&nodeCpus[0], 0, sizeof(CpuSet));
+        for (int cpu = 0; cpu < count; cpu++) {
+            cpuSetAdd(&nodeCpus[0], cpu);
+        }
+        nodes = 1;
+    }
+    return nodes;
+}
 
-    /* 1. Draw FAR STARS as points */
-    for (int i = 0; i < starCount; i++) {
-        if (stars[i].z >= NEAR_THRESHOLD) {
-            float factor = PERSPECTIVE_SCALE / stars[i].z;
-            int x = (int)((gWidth  / 2.0f) + (stars[i].x * factor));
-            int y = (int)((gHeight / 2.0f) + (stars[i].y * factor));
-            SDL_RenderDrawPoint(gRenderer, x, y);
+typedef struct {
+    int     cpu;        /* the one CPU to run on */
+    Uint64* words;
+    size_t  count;
+    int     write;
+    Uint64  sum;
+} BandwidthJob;
+
+static int bandwidthMain(void* data) {
+    BandwidthJob* job = (BandwidthJob*)data;
+    pinThread(job->cpu);
+    if (job->write) {
+        for (size_t i = 0; i < job->count; i++) {
+            job->words[i] = i;
+        }
+        return 0;
+    }
+    Uint64 sum = 0;
+    for (int pass = 0; pass < NODE_BENCH_PASSES; pass++) {
+        for (size_t i = 0; i < job->count; i++) {
+            sum += job->words[i];
         }
     }
+    job->sum = sum;
+    return 0;
+}
 
-    /* 2. Draw NEAR STARS as short lines (trails) */
-    for (int i = 0; i < starCount; i++) {
-        if (stars[i].z < NEAR_THRESHOLD) {
-            float factor = PERSPECTIVE_SCALE / stars[i].z;
-            int newX = (int)((gWidth  / 2.0f) + (stars[i].x * factor));
-            int newY = (int)((gHeight / 2.0f) + (stars[i].y * factor));
+/* Write or read words from threads on cpus; returns seconds taken */
+static double runBandwidth(const CpuSet* cpus, Uint64* words, size_t count, int write) {
+    BandwidthJob jobs[NODE_BENCH_THREADS];
+    SDL_Thread* threads[NODE_BENCH_THREADS];
+    int n = SDL_min(cpus->count, NODE_BENCH_THREADS);
 
-            SDL_RenderDrawLine(gRenderer, 
-                (int)stars[i].oldX, (int)stars[i].oldY,
-                newX, newY);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int t = 0; t < n; t++) {
+        size_t first = count * t / n;
+        BandwidthJob job = { nthCpu(cpus, t), words + first,
+                             count * (t + 1) / n - first, write, 0 };
+        jobs[t] = job;
+        threads[t] = SDL_CreateThread(bandwidthMain, "bandwidth", &jobs[t]);
+        if (!threads[t]) {
+            bandwidthMain(&jobs[t]);
+        }
+    }
+    for (int t = 0; t < n; t++) {
+        if (threads[t]) {
+            SDL_WaitThread(threads[t], NULL);
         }
     }
+    return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
 
-    /* 3. Draw the UI windows using Nuklear */
-    struct nk_style *style = &ctx->style;
-    struct nk_color bg = nk_rgba(0, 0, 0, 200);
-    style->window.background = nk_rgba(0, 0, 0, 200);
-    style->window.fixed_background = nk_style_item_color(bg);
-    style->window.padding = nk_vec2(8, 8);
-    
-    /* Info window (bottom left) */
-    if (nk_begin(ctx, "Info", nk_rect(10, gHeight - 75, 180, 60),
-        NK_WINDOW_NO_SCROLLBAR|NK_WINDOW_NO_INPUT)) {
-        
-        char buf[64];
-        sprintf(buf, "FPS: %.2f", gFPS);
-        
-        nk_layout_row_dynamic(ctx, 20, 1);
-        nk_label_colored(ctx, gRendererInfo.name, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
-        nk_label_colored(ctx, buf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
+static int benchNodeBandwidth(void) {
+    static CpuSet nodeCpus[MAX_NODES];
+    int nodes = readNodeCpus(nodeCpus);
+    size_t count = NODE_BENCH_BYTES / sizeof(Uint64);
+
+    printf("\n%-8s %10s", "memory", "cpus");
+    for (int c = 0; c < nodes; c++) {
+        printf("   node %d GB/s", c);
     }
-    nk_end(ctx);
+    printf("\n");
 
-    /* Settings window (bottom right) */
-    if (nk_begin(ctx, "Settings", nk_rect(gWidth - 320, gHeight - 110, 300, 105),
-        NK_WINDOW_NO_SCROLLBAR)) {
-        
-        nk_layout_row_dynamic(ctx, 20, 1);
-        
-        char buf[32];
-        sprintf(buf, "Stars: %d", starCount);
-        nk_label_colored(ctx, buf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
-        
-        float oldStarValue = starSlider;
-        float oldSpeedValue = speedSlider;
-        
-        nk_slider_float(ctx, 0, &starSlider, 1.0f, 0.01f);
-        
-        char speedBuf[32];
-        sprintf(speedBuf, "Speed: %.2fx", speedSlider * 2.0f);
-        nk_label_colored(ctx, speedBuf, NK_TEXT_LEFT, nk_rgb(0, 255, 0));
-        nk_slider_float(ctx, 0, &speedSlider, 1.0f, 0.01f);
-        
-        /* Handle star count changes */
-        if (oldStarValue != starSlider) {
-            int newCount = (int)(starSlider * 500000.0f);
-            if (newCount < 1) newCount = 1;  /* Ensure at least 1 star */
-            allocateStars(newCount);
+    for (int m = 0; m < nodes; m++) {
+        CpuSet cpus = gAffinity.count ? cpuSetAnd(&nodeCpus[m], &gAffinity) : nodeCpus[m];
+        printf("node %-3d %10d", m, cpus.count);
+        Uint64* words = cpus.count ? (Uint64*)malloc(NODE_BENCH_BYTES) : NULL;
+        if (!words) {
+            printf("%s\n", cpus.count ? "  (could not allocate)" : "  (no CPUs)");
+            continue;
         }
-        
-        /* Handle speed changes */
-        if (oldSpeedValue != speedSlider) {
-            /* Update all existing stars with new speed */
-            for (int i = 0; i < starCount; i++) {
-                stars[i].speed = (BASE_SPEED + SPEED_RANGE * randFloat()) * (speedSlider * 2.0f);
+        runBandwidth(&cpus, words, count, 1);
+
+        for (int c = 0; c < nodes; c++) {
+            CpuSet readers = gAffinity.count ? cpuSetAnd(&nodeCpus[c], &gAffinity) : nodeCpus[c];
+            if (!readers.count) {
+                printf(" %14s", "-");
+                continue;
             }
+            double seconds = runBandwidth(&readers, words, count, 0);
+            printf(" %14.1f", (double)NODE_BENCH_BYTES * NODE_BENCH_PASSES / seconds / 1e9);
         }
+        printf("\n");
+        free(words);
     }
-    nk_end(ctx);
+    return 1;
+}
 
-    /* Render Nuklear */
-    nk_sdl_render(NK_ANTI_ALIASING_ON);
+/*
+ * Simulation thread against none: frames of SIM_BENCH_STARS stars drawn
+ * with bloom on the CPU raster path at 1080p, with the simulation inline
+ * and then on its own thread, both sharing the worker pool.  Each frame
+ * waits for its simulated list, so the times are whole frames.
+ */
+#define SIM_BENCH_STARS  1000000
+#define SIM_BENCH_FRAMES 20
 
-    /* Present the final frame */
-    SDL_RenderPresent(gRenderer);
+/* The draw-side work of a frame */
+static void drawBenchFrame(DrawList* dl) {
+    memset(cpuPixels, 0, layerWidth * layerHeight * sizeof(Uint32));
+    drawStarList(dl);
+    applyBloom(cpuPixels, layerWidth, layerHeight);
 }
 
-static void handleResize(int width, int height) {
-    if (height == 0) height = 1;
+static int benchSimThread(void) {
+    int savedWidth = gWidth, savedHeight = gHeight;
 
-    gWidth = width;
-    gHeight = height;
+    gWidth = BLOOM_BENCH_WIDTH;
+    gHeight = BLOOM_BENCH_HEIGHT;
+    if (!beginCpuBench(SIM_BENCH_STARS)) {
+        gWidth = savedWidth;
+        gHeight = savedHeight;
+        return 0;
+    }
 
-    /*
-     * Re-sync the 'oldX/oldY' for each star to its 
-     * "current" position in the *new* window size.
-     */
-    for (int i = 0; i < starCount; i++) {
-        float factor = PERSPECTIVE_SCALE / stars[i].z;
-        float newX = (gWidth  / 2.0f) + (stars[i].x * factor);
-        float newY = (gHeight / 2.0f) + (stars[i].y * factor);
-        stars[i].oldX = newX;
-        stars[i].oldY = newY;
+    drawBenchFrame(&gDrawList);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < SIM_BENCH_FRAMES; f++) {
+        updateStars();
+        projectStars(&gDrawList);
+        drawBenchFrame(&gDrawList);
+    }
+    Uint64 inlineTicks = SDL_GetPerformanceCounter() - start;
+
+    Uint64 threadTicks = 0;
+    int ok = startSimulation();
+    if (ok) {
+        start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < SIM_BENCH_FRAMES; f++) {
+            while (!takeSimFrame()) {
+                SDL_Delay(0);
+            }
+            DrawList* dl = &sim.lists[sim.front];
+            SDL_SemPost(sim.go);
+            drawBenchFrame(dl);
+        }
+        threadTicks = SDL_GetPerformanceCounter() - start;
+        stopSimulation();
+    }
+
+    double toMs = 1e3 / (double)SDL_GetPerformanceFrequency() / SIM_BENCH_FRAMES;
+    printf("\n%-8s %10s %10s %10s %10s\n", "sim", "stars", "threads", "ms/frame", "vs inline");
+    printf("%-8s %10d %10d %10.2f %9.2fx\n", "inline", SIM_BENCH_STARS, pool.count + 1,
+        inlineTicks * toMs, 1.0);
+    if (ok) {
+        printf("%-8s %10d %10d %10.2f %9.2fx\n", "thread", SIM_BENCH_STARS, pool.count + 2,
+            threadTicks * toMs, (double)inlineTicks / (double)threadTicks);
+    }
+
+    freeBloom();
+    endCpuBench();
+    gWidth = savedWidth;
+    gHeight = savedHeight;
+    return ok;
+}
+
+static int runBenchmark(void) {
+    static const int counts[] = { 100000, 1000000, 10000000 };
+    static const StarFormat formats[] = {
+        STAR_FORMAT_FULL, STAR_FORMAT_PACKED, STAR_FORMAT_SOA, STAR_FORMAT_AOSOA
+    };
+
+    printf("%-8s %10s %8s %10s %10s\n", "format", "stars", "bytes", "ns/star", "Mstars/s");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            double ns = benchStarFormat(formats[f], counts[c]);
+            if (ns < 0.0) {
+                printf("Could not allocate %d stars!\n", counts[c]);
+                return 1;
+            }
+            printf("%-8s %10d %8d %10.2f %10.1f\n", starFormatName(formats[f]), counts[c],
+                starFormatBytes(formats[f]), ns, 1000.0 / ns);
+        }
     }
+
+    int ok = benchSpawnDistribution();
+    ok &= benchRcpPrecision();
+    ok &= benchShading();
+    ok &= benchMotionBlur();
+    ok &= benchRenderScale();
+    ok &= benchBloom();
+    ok &= benchSimThread();
+    ok &= benchNodeBandwidth();
+    stopWorkers();
+    freeDrawList(&gDrawList);
+    freeStaging();
+    return ok ? 0 : 1;
+}
+
+static void printUsage(const char* prog) {
+    printf("Usage: %s [options]\n", prog);
+    printf("  --layout <l>   Star storage: full (default), packed, soa or aosoa\n");
+    printf("  --packed       Same as --layout packed\n");
+    printf("  --rcp <mode>   Depth reciprocal: exact, fast (default) or precise\n");
+    printf("  --raster <r>   Draw stars with the SDL renderer (sdl, default) or on the CPU (cpu)\n");
+    printf("  --aa           Anti-aliased sub-pixel stars (implies --raster cpu)\n");
+    printf("  --trails <d>   Fading trails, keeping fraction d (0.5-0.98) of each frame\n");
+    printf("  --shade        Dim stars with depth\n");
+    printf("  --tint         Give stars a colour from their temperature\n");
+    printf("  --hdr <t>      Accumulate star light and tone map it: reinhard or aces\n");
+    printf("  --lod <depth>  Draw stars beyond depth (0.5-1.0) as a far-field texture\n");
+    printf("  --bloom        Glow around bright stars (implies --raster cpu)\n");
+    printf("  --blur <k>     Motion blur from k sub-frames per frame, 1-%d (implies --raster cpu)\n",
+        MAX_MOTION_STEPS);
+    printf("  --scale <s>    Draw stars at s (0.25-1.0) of the window size and upscale them\n");
+    printf("  --upscale <f>  Upscale filter: nearest, bilinear (default) or sharpen\n");
+    printf("  --budget <ms>  Adapt quality to keep each frame under ms milliseconds\n");
+    printf("  --sim-thread   Simulate the next frame on its own thread while this one is drawn\n");
+    printf("  --affinity <l> Pin worker threads to the CPUs in list l, e.g. 0-7,16-23 (Linux)\n");
+    printf("  --threads <n>  Worker threads besides the main one (default: one per extra CPU)\n");
+    printf("  --bench        Benchmark the star formats and exit\n");
+    printf("  --alloc-check <n> Run n frames hidden and fail if any allocates after warm-up\n");
+    printf("  --help         Show this help\n");
 }
 
 int main(int argc, char** argv) {
+    int bench = 0;
+    int allocCheckFrames = 0;
+
+    /* Parse command line */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--packed") == 0) {
+            gStarFormat = STAR_FORMAT_PACKED;
+        } else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "full") == 0) {
+                gStarFormat = STAR_FORMAT_FULL;
+            } else if (strcmp(argv[i], "packed") == 0) {
+                gStarFormat = STAR_FORMAT_PACKED;
+            } else if (strcmp(argv[i], "soa") == 0) {
+                gStarFormat = STAR_FORMAT_SOA;
+            } else if (strcmp(argv[i], "aosoa") == 0) {
+                gStarFormat = STAR_FORMAT_AOSOA;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rcp") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "exact") == 0) {
+                gRcpPrecision = RCP_EXACT;
+            } else if (strcmp(argv[i], "fast") == 0) {
+                gRcpPrecision = RCP_FAST;
+            } else if (strcmp(argv[i], "precise") == 0) {
+                gRcpPrecision = RCP_PRECISE;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--raster") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "sdl") == 0) {
+                gRasterPath = RASTER_SDL;
+            } else if (strcmp(argv[i], "cpu") == 0) {
+                gRasterPath = RASTER_CPU;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--aa") == 0) {
+            gAntialias = 1;
+            gRasterPath = RASTER_CPU;
+        } else if (strcmp(argv[i], "--trails") == 0 && i + 1 < argc) {
+            float decay = (float)atof(argv[++i]);
+            gTrails = 1;
+            gTrailDecay = SDL_clamp(decay, 0.5f, 0.98f);
+        } else if (strcmp(argv[i], "--shade") == 0) {
+            gDepthShading = 1;
+        } else if (strcmp(argv[i], "--tint") == 0) {
+            gStarTint = 1;
+        } else if (strcmp(argv[i], "--hdr") == 0 && i + 1 < argc) {
+            i++;
+            gHdr = 1;
+            if (strcmp(argv[i], "reinhard") == 0) {
+                gToneMap = TONEMAP_REINHARD;
+            } else if (strcmp(argv[i], "aces") == 0) {
+                gToneMap = TONEMAP_ACES;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--lod") == 0 && i + 1 < argc) {
+            float depth = (float)atof(argv[++i]);
+            gFarLod = 1;
+            gFarLodDepth = SDL_clamp(depth, 0.5f, 1.0f);
+        } else if (strcmp(argv[i], "--bloom") == 0) {
+            gBloom = 1;
+            gRasterPath = RASTER_CPU;
+        } else if (strcmp(argv[i], "--blur") == 0 && i + 1 < argc) {
+            int steps = atoi(argv[++i]);
+            gMotionSteps = SDL_clamp(steps, 1, MAX_MOTION_STEPS);
+            gRasterPath = RASTER_CPU;
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            float scale = (float)atof(argv[++i]);
+            gRenderScale = SDL_clamp(scale, 0.25f, 1.0f);
+        } else if (strcmp(argv[i], "--upscale") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "nearest") == 0) {
+                gUpscale = UPSCALE_NEAREST;
+            } else if (strcmp(argv[i], "bilinear") == 0) {
+                gUpscale = UPSCALE_BILINEAR;
+            } else if (strcmp(argv[i], "sharpen") == 0) {
+                gUpscale = UPSCALE_SHARPEN;
+            } else {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            float budget = (float)atof(argv[++i]);
+            gGovernor = 1;
+            gFrameBudget = SDL_clamp(budget, 4.0f, 33.3f);
+        } else if (strcmp(argv[i], "--sim-thread") == 0) {
+            gSimThread = 1;
+        } else if (strcmp(argv[i], "--affinity") == 0 && i + 1 < argc) {
+            const char* list = argv[++i];
+            if (!parseCpuList(list, &gAffinity)) {
+                printf("Invalid CPU list '%s'; expected e.g. 0-7,16-23\n", list);
+                return 1;
+            }
+            for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+                if (cpuSetHas(&gAffinity, cpu) && !cpuAvailable(cpu)) {
+                    printf("CPU %d in '%s' is not available to this process\n", cpu, list);
+                    return 1;
+                }
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            int threads = atoi(argv[++i]);
+            gWorkerCount = SDL_max(threads, 0);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--alloc-check") == 0 && i + 1 < argc) {
+            int frames = atoi(argv[++i]);
+            allocCheckFrames = SDL_max(frames, 1);
+        } else {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (bench) {
+        srand((unsigned)time(NULL));
+        return runBenchmark();
+    }
+
     /* Initialize SDL */
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         printf("SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
         return 1;
     }
 
-    /* Create window */
+    /* Create window; the allocation check runs it hidden */
     gWindow = SDL_CreateWindow("Starfield95",
         SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
         WINDOW_WIDTH, WINDOW_HEIGHT,
-        SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+        (allocCheckFrames ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN) | SDL_WINDOW_RESIZABLE);
     
     if (!gWindow) {
         printf("Window could not be created! SDL_Error: %s\n", SDL_GetError());
@@ -323,9 +4778,13 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    /* Create renderer */
-    gRenderer = SDL_CreateRenderer(gWindow, -1, 
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    /*
+     * Create renderer.  The allocation check uses the same one without
+     * vsync, which a hidden window may never deliver; SDL_RENDER_DRIVER
+     * picks another (e.g. software) to check that one.
+     */
+    gRenderer = SDL_CreateRenderer(gWindow, -1, SDL_RENDERER_ACCELERATED |
+        (allocCheckFrames ? 0 : SDL_RENDERER_PRESENTVSYNC));
     
     if (!gRenderer) {
         printf("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
@@ -336,6 +4795,7 @@ int main(int argc, char** argv) {
 
     /* Get renderer info */
     SDL_GetRendererInfo(gRenderer, &gRendererInfo);
+    updateRefreshPeriod();
 
     /* Initialize Nuklear */
     ctx = nk_sdl_init(gWindow, gRenderer);
@@ -347,10 +4807,18 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    /* Load Nuklear's default font */
+    /* Load Nuklear's default font, baked on the first run and then cached */
     struct nk_font_atlas *atlas;
+    char* prefPath = SDL_GetPrefPath("", "starfield95");
+    char fontCache[1024];
+    if (prefPath) {
+        snprintf(fontCache, sizeof(fontCache), "%sfont-atlas.bin", prefPath);
+        nk_sdl_font_cache(fontCache);
+        SDL_free(prefPath);
+    }
     nk_sdl_font_stash_begin(&atlas);
     nk_sdl_font_stash_end();
+    nk_sdl_font_cache(NULL);
 
     /* Seed RNG and init stars */
     srand((unsigned)time(NULL));
@@ -369,6 +4837,11 @@ int main(int argc, char** argv) {
     /* Main loop flag */
     int quit = 0;
 
+    /* Allocation check: frames run so far and the count after warm-up */
+    int checkedFrames = 0;
+    Uint64 warmAllocs = 0, warmFrees = 0, warmApp = 0, warmUi = 0;
+    int status = 0;
+
     /* Event handler */
     SDL_Event e;
 
@@ -381,7 +4854,11 @@ int main(int argc, char** argv) {
                 quit = 1;
             } else if (e.type == SDL_WINDOWEVENT) {
                 if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
-                    handleResize(e.window.data1, e.window.data2);
+                    pendingWidth = e.window.data1;
+                    pendingHeight = e.window.data2;
+                } else if (e.window.event == SDL_WINDOWEVENT_MOVED) {
+                    /* Maybe onto a display with another refresh rate */
+                    updateRefreshPeriod();
                 }
             } else if (e.type == SDL_KEYDOWN) {
                 if (e.key.keysym.sym == SDLK_ESCAPE) {
@@ -392,9 +4869,6 @@ int main(int argc, char** argv) {
         }
         nk_input_end(ctx);
 
-        /* Update stars */
-        updateStars();
-
         /* Calculate FPS */
         Uint32 currentTime = SDL_GetTicks();
         gFrames++;
@@ -406,17 +4880,49 @@ int main(int argc, char** argv) {
 
         /* Render */
         render();
+
+        if (allocCheckFrames) {
+            checkedFrames++;
+            if (checkedFrames == ALLOC_WARMUP_FRAMES) {
+                warmAllocs = heapAllocations();
+                warmFrees = heapFrees();
+                warmApp = (Uint64)SDL_AtomicGet(&gAllocations);
+                warmUi = uiAllocations();
+            } else if (checkedFrames == ALLOC_WARMUP_FRAMES + allocCheckFrames) {
+                Uint64 allocs = heapAllocations() - warmAllocs;
+                printf("%d frames after warm-up on %s made %lu allocation(s) (app %lu, UI %lu)\n",
+                    allocCheckFrames, gRendererInfo.name, (unsigned long)allocs,
+                    (unsigned long)((Uint64)SDL_AtomicGet(&gAllocations) - warmApp),
+                    (unsigned long)(uiAllocations() - warmUi));
+                if (PROCESS_ALLOCATIONS) {
+                    printf("and %lu free(s), counted across the whole process\n",
+                        (unsigned long)(heapFrees() - warmFrees));
+                } else {
+                    printf("Only the app's buffers and the UI are counted; "
+                        "make alloc-check builds a binary that counts the whole process\n");
+                }
+                status = allocs != 0;
+                quit = 1;
+            }
+        }
     }
 
     /* Cleanup */
-    if (stars) {
-        free(stars);
-        stars = NULL;
-    }
+    stopSimulation();
+    freeStars();
+    freeDrawList(&gDrawList);
+    freeStaging();
+    free(pixelHits);
+    free(densityPoints);
+    freeFarLod();
+    freeStarLayer();
+    freeBloom();
+    free(shadeSorted);
+    stopWorkers();
     nk_sdl_shutdown();
     SDL_DestroyRenderer(gRenderer);
     SDL_DestroyWindow(gWindow);
     SDL_Quit();
 
-    return 0;
+    return status;
 }